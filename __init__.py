@@ -2,17 +2,63 @@ from esphome import pins, automation
 from esphome.automation import maybe_simple_id
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome.components import spi
-from esphome.const import CONF_ID, CONF_INTERRUPT_PIN
+import esphome.final_validate as fv
+from esphome.components import sensor, spi
+from esphome.const import (
+    CONF_DURATION,
+    CONF_ID,
+    CONF_INTERRUPT_PIN,
+    CONF_POSITION,
+    CONF_SPI_ID,
+    CONF_TRIGGER_ID,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_MICROSECOND,
+    UNIT_PERCENT,
+)
 
 CONF_SDN_PIN = "sdn_pin"
+CONF_CTS_PIN = "cts_pin"
+CONF_CTS_TIMEOUT = "cts_timeout"
+CONF_MERGE_CONFIG_PROPERTIES = "merge_config_properties"
+CONF_EZ_FREQUENCY_PROGRAMMING = "ez_frequency_programming"
+CONF_FREQUENCY_TABLE = "frequency_table"
+CONF_MASSAGE_COALESCE_WINDOW = "massage_coalesce_window"
+CONF_BENCHMARK = "benchmark"
+CONF_RECEIVE = "receive"
+CONF_LEARN_DWELL_TIME = "learn_dwell_time"
+CONF_LEARN_TIMEOUT = "learn_timeout"
+CONF_ON_CHANNEL_LEARNED = "on_channel_learned"
+CONF_LBT_THRESHOLD = "lbt_threshold"
+CONF_LBT_DEFERRALS = "lbt_deferrals"
+CONF_RADIO_TASK = "radio_task"
+CONF_VERIFY_PROPERTIES = "verify_properties"
+CONF_ACTION_LATENCY = "action_latency"
+CONF_PACKET_SPI_TIME = "packet_spi_time"
+CONF_CTS_WAIT = "cts_wait"
+CONF_PACKET_SENT_TIMEOUTS = "packet_sent_timeouts"
+CONF_QUEUE_DEPTH = "queue_depth"
+CONF_METRICS_UPDATE_INTERVAL = "metrics_update_interval"
+CONF_RESET = "reset"
+CONF_TRACE = "trace"
+CONF_DEBUG_LOG = "debug_log"
+CONF_IDLE_SLEEP_TIME = "idle_sleep_time"
+CONF_RX_SNIFF_INTERVAL = "rx_sniff_interval"
+CONF_RX_SNIFF_WINDOW = "rx_sniff_window"
+CONF_WAKE_LATENCY = "wake_latency"
+CONF_HEAD_TRAVEL_TIME = "head_travel_time"
+CONF_LEGS_TRAVEL_TIME = "legs_travel_time"
+CONF_HEAD_POSITION = "head_position"
+CONF_LEGS_POSITION = "legs_position"
 
 CONF_CHANNEL = "channel"
 CONF_CMD = "cmd"
 CONF_TARGET = "target"
 CONF_LEVEL = "level"
+CONF_AXIS = "axis"
 
 DEPENDENCIES = ["spi"]
+AUTO_LOAD = ["sensor"]
 
 temperbridge_ns = cg.esphome_ns.namespace("temperbridge")
 TemperBridge = temperbridge_ns.class_(
@@ -63,6 +109,15 @@ MASSAGE_TARGET = {
 
 validate_massage_target = cv.enum(MASSAGE_TARGET, lower=True)
 
+temperbridge_position_axis_enum = temperbridge_ns.enum("PositionAxis", is_class=True)
+
+POSITION_AXIS = {
+    "head": temperbridge_position_axis_enum.HEAD,
+    "legs": temperbridge_position_axis_enum.LEGS,
+}
+
+validate_position_axis = cv.enum(POSITION_AXIS, lower=True)
+
 ExecuteSimpleCommandAction = temperbridge_ns.class_(
     "ExecuteSimpleCommandAction", automation.Action
 )
@@ -71,13 +126,38 @@ PositionCommandAction = temperbridge_ns.class_(
     "PositionCommandAction", automation.Action
 )
 
+MoveToPositionAction = temperbridge_ns.class_(
+    "MoveToPositionAction", automation.Action
+)
+
 SetMassageIntensityAction = temperbridge_ns.class_(
     "SetMassageIntensityAction", automation.Action
 )
 
 SetChannelAction = temperbridge_ns.class_("SetChannelAction", automation.Action)
 
-CONFIG_SCHEMA = (
+LearnChannelAction = temperbridge_ns.class_("LearnChannelAction", automation.Action)
+
+DumpMetricsAction = temperbridge_ns.class_("DumpMetricsAction", automation.Action)
+
+DumpTraceAction = temperbridge_ns.class_("DumpTraceAction", automation.Action)
+
+ChannelLearnedTrigger = temperbridge_ns.class_(
+    "ChannelLearnedTrigger", automation.Trigger.template(cg.uint16)
+)
+
+
+def validate_rx_sniff(config):
+    if config[CONF_RX_SNIFF_WINDOW].total_milliseconds == 0:
+        raise cv.Invalid(f"{CONF_RX_SNIFF_WINDOW} can't be zero")
+    if config[CONF_RX_SNIFF_WINDOW] >= config[CONF_RX_SNIFF_INTERVAL]:
+        raise cv.Invalid(
+            f"{CONF_RX_SNIFF_WINDOW} must be shorter than {CONF_RX_SNIFF_INTERVAL}"
+        )
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
     cv.Schema(
         {
             cv.GenerateID(): cv.declare_id(TemperBridge),
@@ -85,13 +165,138 @@ CONFIG_SCHEMA = (
             cv.Required(CONF_INTERRUPT_PIN): cv.All(
                 pins.internal_gpio_input_pin_schema
             ),
+            # Wired to the radio's GPIO1, which gets configured as CTS
+            cv.Optional(CONF_CTS_PIN): pins.gpio_input_pin_schema,
+            cv.Optional(
+                CONF_CTS_TIMEOUT, default="50ms"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_MERGE_CONFIG_PROPERTIES, default=True): cv.boolean,
+            cv.Optional(CONF_EZ_FREQUENCY_PROGRAMMING, default=False): cv.boolean,
+            # Trades ~40kB of flash for tuning without any arithmetic
+            cv.Optional(CONF_FREQUENCY_TABLE, default=False): cv.boolean,
+            cv.Optional(
+                CONF_MASSAGE_COALESCE_WINDOW, default="0ms"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_BENCHMARK, default=False): cv.boolean,
+            # Records every SPI transaction in a 2kB ring, see temperbridge.dump_trace
+            cv.Optional(CONF_TRACE, default=False): cv.boolean,
+            # Per-packet and per-command log lines at DEBUG level, compiled out otherwise
+            cv.Optional(CONF_DEBUG_LOG, default=False): cv.boolean,
+            cv.Optional(CONF_RECEIVE, default=False): cv.boolean,
+            # Debugging aid, reads every written property back from the radio
+            cv.Optional(CONF_VERIFY_PROPERTIES, default=False): cv.boolean,
+            # Put the radio to sleep after it had nothing to do for this long
+            cv.Optional(CONF_IDLE_SLEEP_TIME): cv.positive_time_period_milliseconds,
+            # While asleep with receive on, listen for a window this long every interval
+            cv.Optional(
+                CONF_RX_SNIFF_INTERVAL, default="40ms"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(
+                CONF_RX_SNIFF_WINDOW, default="4ms"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(
+                CONF_LEARN_DWELL_TIME, default="100ms"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(
+                CONF_LEARN_TIMEOUT, default="60s"
+            ): cv.positive_time_period_milliseconds,
+            # Listen before talk, skip transmitting while the channel is louder than this
+            cv.Optional(CONF_LBT_THRESHOLD): cv.int_range(min=-130, max=-20),
+            cv.Optional(CONF_LBT_DEFERRALS): sensor.sensor_schema(
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_TOTAL_INCREASING,
+            ),
+            # Time each axis takes from flat to fully raised, used to estimate its position
+            cv.Optional(
+                CONF_HEAD_TRAVEL_TIME, default="30s"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(
+                CONF_LEGS_TRAVEL_TIME, default="30s"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_HEAD_POSITION): sensor.sensor_schema(
+                unit_of_measurement=UNIT_PERCENT,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+            ),
+            cv.Optional(CONF_LEGS_POSITION): sensor.sensor_schema(
+                unit_of_measurement=UNIT_PERCENT,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+            ),
+            # Latency sensors report the 95th percentile over each update interval
+            cv.Optional(CONF_ACTION_LATENCY): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MICROSECOND,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+            ),
+            cv.Optional(CONF_PACKET_SPI_TIME): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MICROSECOND,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+            ),
+            cv.Optional(CONF_CTS_WAIT): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MICROSECOND,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+            ),
+            cv.Optional(CONF_PACKET_SENT_TIMEOUTS): sensor.sensor_schema(
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_TOTAL_INCREASING,
+            ),
+            # From waking the radio for a command to its first packet
+            cv.Optional(CONF_WAKE_LATENCY): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MICROSECOND,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+            ),
+            # Deepest the TX queue got during each update interval
+            cv.Optional(CONF_QUEUE_DEPTH): sensor.sensor_schema(
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+            ),
+            cv.Optional(
+                CONF_METRICS_UPDATE_INTERVAL, default="60s"
+            ): cv.positive_time_period_milliseconds,
+            # Run the radio on its own FreeRTOS task, so API handling and logging in the loop task
+            # can't delay packets. On dual core chips it runs on core 0 next to WiFi, at a lower
+            # priority than the WiFi and lwIP tasks. The task talks SPI without a bus lock, so the
+            # radio needs an SPI bus of its own.
+            cv.Optional(CONF_RADIO_TASK): cv.All(cv.boolean, cv.only_on_esp32),
+            cv.Optional(CONF_ON_CHANNEL_LEARNED): automation.validate_automation(
+                {
+                    cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(
+                        ChannelLearnedTrigger
+                    ),
+                }
+            ),
         }
     )
     .extend(cv.COMPONENT_SCHEMA)
-    .extend(spi.spi_device_schema(cs_pin_required=True))
+    .extend(spi.spi_device_schema(cs_pin_required=True)),
+    validate_rx_sniff,
 )
 
 
+def _final_validate_radio_task(config):
+    if not config.get(CONF_RADIO_TASK, False):
+        return config
+    # The radio task doesn't take a bus lock, so no other device may sit on its bus
+    bus = config[CONF_SPI_ID].id
+    for confs in fv.full_config.get().values():
+        for conf in confs if isinstance(confs, list) else [confs]:
+            if not isinstance(conf, dict) or conf.get(CONF_ID) == config[CONF_ID]:
+                continue
+            other = conf.get(CONF_SPI_ID)
+            if other is not None and other.id == bus:
+                raise cv.Invalid(
+                    f"{CONF_RADIO_TASK} needs an SPI bus of its own, '{bus}' is shared"
+                )
+    return config
+
+
+FINAL_VALIDATE_SCHEMA = _final_validate_radio_task
+
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
@@ -103,6 +308,65 @@ async def to_code(config):
     sdn_pin = await cg.gpio_pin_expression(config[CONF_SDN_PIN])
     cg.add(var.set_sdn_pin(sdn_pin))
 
+    if CONF_CTS_PIN in config:
+        cts_pin = await cg.gpio_pin_expression(config[CONF_CTS_PIN])
+        cg.add(var.set_cts_pin(cts_pin))
+
+    cg.add(var.set_cts_timeout(config[CONF_CTS_TIMEOUT]))
+    cg.add(var.set_merge_config_properties(config[CONF_MERGE_CONFIG_PROPERTIES]))
+    cg.add(var.set_ez_frequency_programming(config[CONF_EZ_FREQUENCY_PROGRAMMING]))
+    cg.add(var.set_massage_coalesce_window(config[CONF_MASSAGE_COALESCE_WINDOW]))
+    cg.add(var.set_receive(config[CONF_RECEIVE]))
+    cg.add(var.set_verify_properties(config[CONF_VERIFY_PROPERTIES]))
+    cg.add(var.set_learn_dwell_time(config[CONF_LEARN_DWELL_TIME]))
+    cg.add(var.set_learn_timeout(config[CONF_LEARN_TIMEOUT]))
+    if CONF_IDLE_SLEEP_TIME in config:
+        cg.add(var.set_idle_sleep_time(config[CONF_IDLE_SLEEP_TIME]))
+    cg.add(var.set_rx_sniff_interval(config[CONF_RX_SNIFF_INTERVAL]))
+    cg.add(var.set_rx_sniff_window(config[CONF_RX_SNIFF_WINDOW]))
+
+    if CONF_LBT_THRESHOLD in config:
+        cg.add(var.set_lbt_threshold(config[CONF_LBT_THRESHOLD]))
+    if CONF_LBT_DEFERRALS in config:
+        sens = await sensor.new_sensor(config[CONF_LBT_DEFERRALS])
+        cg.add(var.set_lbt_deferrals_sensor(sens))
+
+    cg.add(var.set_travel_time(POSITION_AXIS["head"], config[CONF_HEAD_TRAVEL_TIME]))
+    cg.add(var.set_travel_time(POSITION_AXIS["legs"], config[CONF_LEGS_TRAVEL_TIME]))
+    if CONF_HEAD_POSITION in config:
+        sens = await sensor.new_sensor(config[CONF_HEAD_POSITION])
+        cg.add(var.set_position_sensor(POSITION_AXIS["head"], sens))
+    if CONF_LEGS_POSITION in config:
+        sens = await sensor.new_sensor(config[CONF_LEGS_POSITION])
+        cg.add(var.set_position_sensor(POSITION_AXIS["legs"], sens))
+
+    cg.add(var.set_metrics_update_interval(config[CONF_METRICS_UPDATE_INTERVAL]))
+    for key, setter in (
+        (CONF_ACTION_LATENCY, var.set_action_latency_sensor),
+        (CONF_PACKET_SPI_TIME, var.set_packet_spi_time_sensor),
+        (CONF_CTS_WAIT, var.set_cts_wait_sensor),
+        (CONF_PACKET_SENT_TIMEOUTS, var.set_packet_sent_timeouts_sensor),
+        (CONF_QUEUE_DEPTH, var.set_queue_depth_sensor),
+        (CONF_WAKE_LATENCY, var.set_wake_latency_sensor),
+    ):
+        if key in config:
+            sens = await sensor.new_sensor(config[key])
+            cg.add(setter(sens))
+
+    for conf in config.get(CONF_ON_CHANNEL_LEARNED, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(trigger, [(cg.uint16, "channel")], conf)
+    if config[CONF_FREQUENCY_TABLE]:
+        cg.add_define("USE_TEMPERBRIDGE_FREQ_TABLE")
+    if config[CONF_BENCHMARK]:
+        cg.add_define("USE_TEMPERBRIDGE_BENCHMARK")
+    if config[CONF_TRACE]:
+        cg.add_define("USE_TEMPERBRIDGE_TRACE")
+    if config[CONF_DEBUG_LOG]:
+        cg.add_define("USE_TEMPERBRIDGE_DEBUG_LOG")
+    if config.get(CONF_RADIO_TASK, False):
+        cg.add_define("USE_TEMPERBRIDGE_RADIO_TASK")
+
 
 @automation.register_action(
     "temperbridge.position_command_2",
@@ -111,6 +375,10 @@ async def to_code(config):
         {
             cv.GenerateID(): cv.use_id(TemperBridge),
             cv.Required(CONF_CMD): cv.templatable(validate_position_command),
+            # Keep moving this long and then stop, instead of a short nudge
+            cv.Optional(CONF_DURATION): cv.templatable(
+                cv.positive_time_period_milliseconds
+            ),
         },
     ),
 )
@@ -120,6 +388,30 @@ async def temperbridge_start_position_command_to_code(
     var = cg.new_Pvariable(action_id, template_arg)
     await cg.register_parented(var, config[CONF_ID])
     cg.add(var.set_cmd(config[CONF_CMD]))
+    if CONF_DURATION in config:
+        template_ = await cg.templatable(config[CONF_DURATION], args, cg.uint32)
+        cg.add(var.set_duration(template_))
+    return var
+
+
+@automation.register_action(
+    "temperbridge.move_to_position",
+    MoveToPositionAction,
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(TemperBridge),
+            cv.Required(CONF_AXIS): cv.templatable(validate_position_axis),
+            cv.Required(CONF_POSITION): cv.templatable(cv.percentage),
+        }
+    ),
+)
+async def temperbridge_move_to_position_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    template_ = await cg.templatable(config[CONF_AXIS], args, validate_position_axis)
+    cg.add(var.set_axis(template_))
+    template_ = await cg.templatable(config[CONF_POSITION], args, cg.float_)
+    cg.add(var.set_position(template_))
     return var
 
 
@@ -142,7 +434,8 @@ async def temperbridge_execute_simple_command_to_code(
     return var
 
 
-validate_channel = cv.All(cv.int_range(min=0, max=9999))
+# Same range as TEMPER_MAX_CHANNEL, which channel learning can adopt
+validate_channel = cv.All(cv.int_range(min=1, max=10111))
 
 
 @automation.register_action(
@@ -164,6 +457,54 @@ async def temperbridge_set_channel_to_code(config, action_id, template_arg, args
     return var
 
 
+@automation.register_action(
+    "temperbridge.learn_channel",
+    LearnChannelAction,
+    maybe_simple_id(
+        {
+            cv.GenerateID(): cv.use_id(TemperBridge),
+        }
+    ),
+)
+async def temperbridge_learn_channel_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
+
+
+@automation.register_action(
+    "temperbridge.dump_metrics",
+    DumpMetricsAction,
+    maybe_simple_id(
+        {
+            cv.GenerateID(): cv.use_id(TemperBridge),
+            cv.Optional(CONF_RESET, default=False): cv.templatable(cv.boolean),
+        }
+    ),
+)
+async def temperbridge_dump_metrics_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    template_ = await cg.templatable(config[CONF_RESET], args, cg.bool_)
+    cg.add(var.set_reset(template_))
+    return var
+
+
+@automation.register_action(
+    "temperbridge.dump_trace",
+    DumpTraceAction,
+    maybe_simple_id(
+        {
+            cv.GenerateID(): cv.use_id(TemperBridge),
+        }
+    ),
+)
+async def temperbridge_dump_trace_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
+
+
 validate_massage_level = cv.All(cv.int_range(min=0, max=10))
 
 
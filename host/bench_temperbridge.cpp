@@ -0,0 +1,103 @@
+// Runs the benchmark that setup() does with benchmark: true, on the host against the simulated radio and the real
+// clock, and writes the JSON line dump_config logs to a file for scripts/compare_benchmark.py.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include "si446x.h"
+#include "temperbridge.h"
+#include "si446x_sim.h"
+
+#ifndef USE_TEMPERBRIDGE_BENCHMARK
+#error "Build with -DUSE_TEMPERBRIDGE_BENCHMARK"
+#endif
+
+using namespace esphome;
+using namespace esphome::temperbridge;
+
+// micros() only has microsecond resolution, the best of several runs smooths that and scheduling noise out
+static const int RUNS = 7;
+static const char *const BENCHMARK_PREFIX = "Benchmark: ";
+
+// The JSON object from the last benchmark line in the log, empty if there is none
+static std::string scrape_benchmark() {
+  const auto &lines = host::log_lines();
+  for (auto it = lines.rbegin(); it != lines.rend(); ++it) {
+    const size_t pos = it->find(BENCHMARK_PREFIX);
+    if (pos != std::string::npos) {
+      return it->substr(pos + strlen(BENCHMARK_PREFIX));
+    }
+  }
+  return "";
+}
+
+// Just enough to read back the flat object of integers dump_config writes
+static std::map<std::string, unsigned long> parse_benchmark(const std::string &json) {
+  std::map<std::string, unsigned long> ret;
+  size_t pos = 0;
+  while ((pos = json.find('"', pos)) != std::string::npos) {
+    const size_t end = json.find('"', pos + 1);
+    const size_t colon = json.find(':', end);
+    if (end == std::string::npos || colon == std::string::npos) {
+      break;
+    }
+    ret[json.substr(pos + 1, end - pos - 1)] = strtoul(json.c_str() + colon + 1, nullptr, 10);
+    pos = colon;
+  }
+  return ret;
+}
+
+int main(int argc, char **argv) {
+  const char *output = argc > 1 ? argv[1] : nullptr;
+  host::use_real_time(true);
+
+  std::map<std::string, unsigned long> best;
+  for (int run = 0; run < RUNS; run++) {
+    host::clear_log();
+    Si446xSim sim;
+    spi::set_host_target(&sim);
+    TemperBridgeComponent bridge;
+    bridge.set_interrupt_pin(sim.irq_pin());
+    bridge.set_sdn_pin(sim.sdn_pin());
+    bridge.set_channel(1);
+    bridge.setup();
+    bridge.dump_config();
+
+    const std::string line = scrape_benchmark();
+    const auto results = parse_benchmark(line);
+    if (results.empty()) {
+      fprintf(stderr, "No benchmark line in the log\n");
+      return 1;
+    }
+    for (const auto &result : results) {
+      auto it = best.find(result.first);
+      if (it == best.end() || result.second < it->second) {
+        best[result.first] = result.second;
+      }
+    }
+  }
+
+  // Same format as the dump_config line, so device logs and this file compare alike
+  std::string json = "{";
+  for (const auto &result : best) {
+    if (json.size() > 1) {
+      json += ",";
+    }
+    json += "\"" + result.first + "\":" + std::to_string(result.second);
+  }
+  json += "}";
+
+  printf("%s%s\n", BENCHMARK_PREFIX, json.c_str());
+  if (output != nullptr) {
+    FILE *file = fopen(output, "w");
+    if (file == nullptr) {
+      perror(output);
+      return 1;
+    }
+    fprintf(file, "%s\n", json.c_str());
+    fclose(file);
+  }
+  return 0;
+}
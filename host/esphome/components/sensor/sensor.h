@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+
+#include "esphome/core/component.h"
+
+namespace esphome {
+namespace sensor {
+
+class Sensor {
+ public:
+  void publish_state(float state) {
+    this->state = state;
+    this->publish_count++;
+  }
+
+  float state{0.0f};
+  uint32_t publish_count{0};
+};
+
+}  // namespace sensor
+}  // namespace esphome
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "esphome/core/component.h"
+
+namespace esphome {
+namespace spi {
+
+enum SPIBitOrder {
+  BIT_ORDER_LSB_FIRST,
+  BIT_ORDER_MSB_FIRST,
+};
+enum SPIClockPolarity {
+  CLOCK_POLARITY_LOW = false,
+  CLOCK_POLARITY_HIGH = true,
+};
+enum SPIClockPhase {
+  CLOCK_PHASE_LEADING,
+  CLOCK_PHASE_TRAILING,
+};
+enum SPIDataRate : uint32_t {
+  DATA_RATE_1MHZ = 1000000,
+  DATA_RATE_4MHZ = 4000000,
+  DATA_RATE_8MHZ = 8000000,
+};
+
+// Whatever sits on the other end of the bus on the host, the simulated radio
+class SPIHostTarget {
+ public:
+  virtual ~SPIHostTarget() = default;
+  virtual void select() = 0;
+  virtual void deselect() = 0;
+  virtual uint8_t transfer(uint8_t data) = 0;
+};
+
+void set_host_target(SPIHostTarget *target);
+SPIHostTarget *get_host_target();
+// Accounts for the time a byte takes on the wire
+void host_clock_bytes(size_t bytes, uint32_t data_rate);
+
+template<SPIBitOrder BIT_ORDER, SPIClockPolarity CLOCK_POLARITY, SPIClockPhase CLOCK_PHASE, SPIDataRate DATA_RATE>
+class SPIDevice {
+ public:
+  void spi_setup() {}
+  void spi_teardown() {}
+
+  void enable() { get_host_target()->select(); }
+  void disable() { get_host_target()->deselect(); }
+
+  uint8_t transfer_byte(uint8_t data) {
+    host_clock_bytes(1, DATA_RATE);
+    return get_host_target()->transfer(data);
+  }
+  void transfer_array(uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+      data[i] = this->transfer_byte(data[i]);
+    }
+  }
+  uint8_t read_byte() { return this->transfer_byte(0x00); }
+  void read_array(uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+      data[i] = this->read_byte();
+    }
+  }
+  void write_byte(uint8_t data) { this->transfer_byte(data); }
+  void write_array(const uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+      this->write_byte(data[i]);
+    }
+  }
+};
+
+}  // namespace spi
+}  // namespace esphome
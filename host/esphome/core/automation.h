@@ -0,0 +1,88 @@
+#pragma once
+#include <functional>
+#include <tuple>
+#include <utility>
+
+#include "esphome/core/component.h"
+
+namespace esphome {
+
+template<typename T, typename... X> class TemplatableValue {
+ public:
+  TemplatableValue() = default;
+  TemplatableValue(T value) : value_(value), has_value_(true) {}
+  template<typename F, typename = decltype(std::declval<F>()(std::declval<X>()...))>
+  TemplatableValue(F f) : f_(f), has_value_(true) {}
+
+  bool has_value() const { return this->has_value_; }
+  T value(X... x) { return this->f_ ? this->f_(x...) : this->value_; }
+
+ protected:
+  T value_{};
+  std::function<T(X...)> f_;
+  bool has_value_{false};
+};
+
+#define TEMPLATABLE_VALUE_(type, name) \
+ protected: \
+  TemplatableValue<type, Ts...> name##_{}; \
+\
+ public: \
+  template<typename V> void set_##name(V name) { this->name##_ = name; }
+
+#define TEMPLATABLE_VALUE(type, name) TEMPLATABLE_VALUE_(type, name)
+
+template<typename... Ts> class Action {
+ public:
+  virtual ~Action() = default;
+  virtual void play_complex(Ts... x) {
+    this->num_running_++;
+    this->play(x...);
+    this->play_next_(x...);
+  }
+  void stop_complex() {
+    if (this->num_running_ > 0) {
+      this->stop();
+      this->num_running_ = 0;
+    }
+  }
+  virtual bool is_running() { return this->num_running_ > 0; }
+  void set_next(Action<Ts...> *next) { this->next_ = next; }
+
+ protected:
+  virtual void play(Ts... x) = 0;
+  virtual void stop() {}
+
+  void play_next_(Ts... x) {
+    if (this->num_running_ > 0) {
+      this->num_running_--;
+      if (this->next_ != nullptr) {
+        this->next_->play_complex(x...);
+      }
+    }
+  }
+  template<int... S> void play_next_tuple_(const std::tuple<Ts...> &tuple, std::integer_sequence<int, S...>) {
+    this->play_next_(std::get<S>(tuple)...);
+  }
+  void play_next_tuple_(const std::tuple<Ts...> &tuple) {
+    this->play_next_tuple_(tuple, std::make_integer_sequence<int, sizeof...(Ts)>{});
+  }
+
+  Action<Ts...> *next_{nullptr};
+  int num_running_{0};
+};
+
+template<typename... Ts> class Trigger {
+ public:
+  void trigger(Ts... x) {
+    if (this->on_trigger_) {
+      this->on_trigger_(x...);
+    }
+  }
+  void set_on_trigger(std::function<void(Ts...)> &&f) { this->on_trigger_ = std::move(f); }
+
+ protected:
+  std::function<void(Ts...)> on_trigger_;
+};
+
+}  // namespace esphome
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "esphome/core/gpio.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+
+class Component {
+ public:
+  virtual ~Component();
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+
+  void mark_failed() { this->failed_ = true; }
+  bool is_failed() const { return this->failed_; }
+  void status_set_warning(const char *message = "") { this->warning_ = true; }
+  void status_clear_warning() { this->warning_ = false; }
+  bool status_has_warning() const { return this->warning_; }
+
+ protected:
+  // Run by host::run_scheduler() from the test driver, like the ESPHome scheduler does from the main loop
+  void set_interval(const std::string &name, uint32_t interval, std::function<void()> &&f);
+  void set_timeout(const std::string &name, uint32_t timeout, std::function<void()> &&f);
+  void set_timeout(uint32_t timeout, std::function<void()> &&f) { this->set_timeout("", timeout, std::move(f)); }
+  bool cancel_interval(const std::string &name);
+  bool cancel_timeout(const std::string &name);
+  void defer(std::function<void()> &&f) { this->set_timeout("", 0, std::move(f)); }
+
+  bool failed_{false};
+  bool warning_{false};
+};
+
+namespace host {
+// Runs every timeout and interval that is due
+void run_scheduler();
+}  // namespace host
+
+}  // namespace esphome
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+
+namespace esphome {
+
+namespace gpio {
+enum Flags : uint8_t {
+  FLAG_NONE = 0x00,
+  FLAG_INPUT = 0x01,
+  FLAG_OUTPUT = 0x02,
+};
+enum InterruptType : uint8_t {
+  INTERRUPT_RISING_EDGE = 1,
+  INTERRUPT_FALLING_EDGE = 2,
+  INTERRUPT_ANY_EDGE = 3,
+};
+}  // namespace gpio
+
+class GPIOPin {
+ public:
+  virtual ~GPIOPin() = default;
+  virtual void setup() = 0;
+  virtual void pin_mode(gpio::Flags flags) = 0;
+  virtual bool digital_read() = 0;
+  virtual void digital_write(bool value) = 0;
+};
+
+class InternalGPIOPin;
+
+class ISRInternalGPIOPin {
+ public:
+  ISRInternalGPIOPin() = default;
+  ISRInternalGPIOPin(InternalGPIOPin *pin) : pin_(pin) {}
+  bool digital_read();
+
+ protected:
+  InternalGPIOPin *pin_{nullptr};
+};
+
+class InternalGPIOPin : public GPIOPin {
+ public:
+  template<typename T> void attach_interrupt(void (*func)(T *), T *arg, gpio::InterruptType type) const {
+    this->attach_interrupt(reinterpret_cast<void (*)(void *)>(func), arg, type);
+  }
+  virtual void attach_interrupt(void (*func)(void *), void *arg, gpio::InterruptType type) const = 0;
+  virtual void detach_interrupt() const = 0;
+  ISRInternalGPIOPin to_isr() const { return ISRInternalGPIOPin(const_cast<InternalGPIOPin *>(this)); }
+};
+
+inline bool ISRInternalGPIOPin::digital_read() { return this->pin_->digital_read(); }
+
+}  // namespace esphome
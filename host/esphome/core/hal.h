@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+
+#define IRAM_ATTR
+#define PROGMEM
+
+namespace esphome {
+
+// Time on the host is virtual: it only moves with delays, SPI traffic and the test driver, so runs are repeatable.
+// Benchmarks switch to the real monotonic clock instead.
+uint32_t micros();
+uint32_t millis();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+inline uint8_t progmem_read_byte(const uint8_t *addr) { return *addr; }
+inline uint16_t progmem_read_uint16(const uint16_t *addr) { return *addr; }
+
+namespace host {
+void advance_us(uint32_t us);
+void use_real_time(bool real_time);
+}  // namespace host
+
+}  // namespace esphome
@@ -0,0 +1,100 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define PACKED __attribute__((packed))
+
+namespace esphome {
+
+using std::clamp;
+
+template<typename T> constexpr T byteswap(T n) {
+  T m = 0;
+  for (size_t i = 0; i < sizeof(T); i++) {
+    m = (m << 8) | (n & 0xFF);
+    n >>= 8;
+  }
+  return m;
+}
+
+// The host is little endian like the ESP targets
+template<typename T> constexpr T convert_big_endian(T val) { return byteswap(val); }
+
+uint32_t random_uint32();
+
+namespace host {
+// random_uint32() is a fixed pseudo random sequence on the host, this restarts it
+void seed_random(uint32_t seed);
+}  // namespace host
+
+template<typename T> class Parented {
+ public:
+  Parented() = default;
+  Parented(T *parent) : parent_(parent) {}
+  T *get_parent() const { return this->parent_; }
+  void set_parent(T *parent) { this->parent_ = parent; }
+
+ protected:
+  T *parent_{nullptr};
+};
+
+template<typename... X> class CallbackManager;
+template<typename... Ts> class CallbackManager<void(Ts...)> {
+ public:
+  void add(std::function<void(Ts...)> &&callback) {
+    // The real one iterates the vector in call(), so this would be undefined behaviour there
+    assert(this->calling_ == 0 && "callback added from inside a callback");
+    this->callbacks_.push_back(std::move(callback));
+  }
+  void call(Ts... args) {
+    this->calling_++;
+    for (auto &cb : this->callbacks_) {
+      cb(args...);
+    }
+    this->calling_--;
+  }
+  size_t size() const { return this->callbacks_.size(); }
+
+ protected:
+  std::vector<std::function<void(Ts...)>> callbacks_;
+  int calling_{0};
+};
+
+class HighFrequencyLoopRequester {
+ public:
+  ~HighFrequencyLoopRequester() { this->stop(); }
+  void start();
+  void stop();
+  static bool is_high_frequency();
+
+ protected:
+  bool started_{false};
+};
+
+class Mutex {
+ public:
+  void lock() { this->mutex_.lock(); }
+  bool try_lock() { return this->mutex_.try_lock(); }
+  void unlock() { this->mutex_.unlock(); }
+
+ protected:
+  std::mutex mutex_;
+};
+
+class LockGuard {
+ public:
+  LockGuard(Mutex &mutex) : mutex_(mutex) { this->mutex_.lock(); }
+  ~LockGuard() { this->mutex_.unlock(); }
+
+ protected:
+  Mutex &mutex_;
+};
+
+}  // namespace esphome
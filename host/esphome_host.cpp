@@ -0,0 +1,236 @@
+// The little of ESPHome the component needs, implemented for a Linux host: a virtual clock, the logger, the
+// scheduler behind set_timeout/set_interval and the SPI bus routed to a simulated device.
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <memory>
+#include <thread>
+
+#include "esphome/components/spi/spi.h"
+#include "esphome/core/component.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+
+static uint64_t virtual_us = 0;
+static bool real_time = false;
+static const auto REAL_TIME_START = std::chrono::steady_clock::now();
+
+static uint64_t now_us() {
+  if (real_time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - REAL_TIME_START)
+        .count();
+  }
+  return virtual_us;
+}
+
+uint32_t micros() { return now_us(); }
+uint32_t millis() { return now_us() / 1000; }
+
+void delayMicroseconds(uint32_t us) {
+  if (real_time) {
+    const uint64_t end = now_us() + us;
+    while (now_us() < end) {
+    }
+    return;
+  }
+  host::advance_us(us);
+}
+
+void delay(uint32_t ms) {
+  if (real_time) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    return;
+  }
+  host::advance_us(ms * 1000);
+}
+
+void yield() {}
+
+namespace host {
+
+void advance_us(uint32_t us) {
+  if (!real_time) {
+    virtual_us += us;
+  }
+}
+
+void use_real_time(bool enable) { real_time = enable; }
+
+}  // namespace host
+
+// Logger
+
+static std::vector<std::string> log_lines;
+static bool log_echo = false;
+
+void esp_log_printf_(int level, const char *tag, int line, const char *format, ...) {
+  static const char LEVELS[] = "?EWICDV";
+  char message[512];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+
+  char formatted[600];
+  snprintf(formatted, sizeof(formatted), "[%c][%s:%d]: %s", LEVELS[level], tag, line, message);
+  log_lines.emplace_back(formatted);
+  if (log_echo) {
+    fprintf(stderr, "%s\n", formatted);
+  }
+}
+
+namespace host {
+
+const std::vector<std::string> &log_lines() { return esphome::log_lines; }
+void clear_log() { esphome::log_lines.clear(); }
+void set_log_echo(bool echo) { log_echo = echo; }
+
+}  // namespace host
+
+// Scheduler
+
+namespace {
+
+struct SchedulerItem {
+  Component *component;
+  std::string name;
+  uint32_t interval;
+  uint32_t next_run;
+  bool repeat;
+  std::function<void()> callback;
+  bool removed;
+};
+
+std::vector<std::shared_ptr<SchedulerItem>> scheduler_items;
+
+bool cancel_item(Component *component, const std::string &name, bool repeat) {
+  bool ret = false;
+  for (auto &item : scheduler_items) {
+    if (item->component == component && !item->removed && item->repeat == repeat && item->name == name) {
+      item->removed = true;
+      ret = true;
+    }
+  }
+  return ret;
+}
+
+void add_item(Component *component, const std::string &name, uint32_t interval, bool repeat,
+              std::function<void()> &&callback) {
+  // Like ESPHome, a named item replaces the previous one of the same name
+  if (!name.empty()) {
+    cancel_item(component, name, repeat);
+  }
+  auto item = std::make_shared<SchedulerItem>();
+  item->component = component;
+  item->name = name;
+  item->interval = interval;
+  item->next_run = millis() + interval;
+  item->repeat = repeat;
+  item->callback = std::move(callback);
+  item->removed = false;
+  scheduler_items.push_back(std::move(item));
+}
+
+}  // namespace
+
+Component::~Component() {
+  for (auto &item : scheduler_items) {
+    if (item->component == this) {
+      item->removed = true;
+    }
+  }
+}
+
+void Component::set_interval(const std::string &name, uint32_t interval, std::function<void()> &&f) {
+  add_item(this, name, interval, true, std::move(f));
+}
+
+void Component::set_timeout(const std::string &name, uint32_t timeout, std::function<void()> &&f) {
+  add_item(this, name, timeout, false, std::move(f));
+}
+
+bool Component::cancel_interval(const std::string &name) { return cancel_item(this, name, true); }
+
+bool Component::cancel_timeout(const std::string &name) { return cancel_item(this, name, false); }
+
+namespace host {
+
+void run_scheduler() {
+  // Items added by the callbacks wait for the next call, deferred work never runs inside the call that deferred it
+  const auto items = scheduler_items;
+  const uint32_t now = millis();
+  for (const auto &item : items) {
+    if (item->removed || static_cast<int32_t>(now - item->next_run) < 0) {
+      continue;
+    }
+    if (item->repeat) {
+      item->next_run += item->interval == 0 ? 1 : item->interval;
+    } else {
+      item->removed = true;
+    }
+    item->callback();
+  }
+
+  for (auto it = scheduler_items.begin(); it != scheduler_items.end();) {
+    it = (*it)->removed ? scheduler_items.erase(it) : it + 1;
+  }
+}
+
+}  // namespace host
+
+// Helpers
+
+static uint32_t random_state = 0x12345678;
+
+uint32_t random_uint32() {
+  // xorshift32, repeatable across runs
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+namespace host {
+void seed_random(uint32_t seed) { random_state = seed == 0 ? 1 : seed; }
+}  // namespace host
+
+static int high_frequency_requests = 0;
+
+void HighFrequencyLoopRequester::start() {
+  if (this->started_) {
+    return;
+  }
+  this->started_ = true;
+  high_frequency_requests++;
+}
+
+void HighFrequencyLoopRequester::stop() {
+  if (!this->started_) {
+    return;
+  }
+  this->started_ = false;
+  high_frequency_requests--;
+}
+
+bool HighFrequencyLoopRequester::is_high_frequency() { return high_frequency_requests > 0; }
+
+// SPI
+
+namespace spi {
+
+static SPIHostTarget *host_target = nullptr;
+
+void set_host_target(SPIHostTarget *target) { host_target = target; }
+SPIHostTarget *get_host_target() { return host_target; }
+
+void host_clock_bytes(size_t bytes, uint32_t data_rate) {
+  // Eight clocks per byte, rounded up to whole microseconds over the transaction
+  host::advance_us((bytes * 8 * 1000000ULL + data_rate - 1) / data_rate);
+}
+
+}  // namespace spi
+
+}  // namespace esphome
@@ -0,0 +1,473 @@
+#include <algorithm>
+#include <cmath>
+
+#include "si446x_sim.h"
+#include "si446x.h"
+#include "esphome/core/hal.h"
+
+namespace esphome {
+namespace temperbridge {
+
+static const uint8_t SI446X_CMD_POWER_UP = 0x02;
+
+static const uint8_t SI446X_STATE_SPI_ACTIVE = 0x02;
+static const uint8_t SI446X_STATE_TX = 0x07;
+
+static const uint8_t SI446X_PROP_INT_CTL_ENABLE = 0x00;
+static const uint8_t SI446X_PROP_INT_CTL_MODEM_ENABLE = 0x02;
+static const uint8_t SI446X_PROP_INT_CTL_CHIP_ENABLE = 0x03;
+static const uint8_t SI446X_PROP_GROUP_FRR_CTL = 0x02;
+
+static const uint8_t SI446X_CHIP_READY_PEND = 1 << 2;
+static const uint8_t SI446X_MODEM_SYNC_DETECT_PEND = 1 << 0;
+
+// FRR_CTL_x_MODE values
+static const uint8_t SI446X_FRR_INT_STATUS = 1;
+static const uint8_t SI446X_FRR_CURRENT_STATE = 9;
+
+static const double SI446X_XO_HZ = 30000000.0;
+// Output divider for the 420-525 MHz band
+static const double SI446X_OUTDIV = 8.0;
+// Half the channel filter bandwidth, packets further off than this aren't heard
+static const double SI446X_RX_HALF_BANDWIDTH_HZ = 38000.0;
+
+// Busy times after the command has been clocked in, roughly what a real chip takes
+static const uint32_t SI446X_START_TX_US = 60;
+static const uint32_t SI446X_START_RX_US = 80;
+static const uint32_t SI446X_CHANGE_STATE_US = 50;
+
+static bool time_reached(uint32_t now, uint32_t at) { return static_cast<int32_t>(now - at) >= 0; }
+
+Si446xSim::Si446xSim() { this->reset_properties_(); }
+
+void Si446xSim::SdnPin::digital_write(bool value) {
+  if (value == this->value_) {
+    return;
+  }
+  this->value_ = value;
+  if (value) {
+    this->sim_->shutdown_();
+  } else {
+    this->sim_->release_shutdown_();
+  }
+}
+
+bool Si446xSim::IrqPin::digital_read() {
+  this->sim_->update();
+  return this->sim_->nirq();
+}
+
+void Si446xSim::IrqPin::attach_interrupt(void (*func)(void *), void *arg, gpio::InterruptType type) const {
+  this->func_ = func;
+  this->arg_ = arg;
+  this->type_ = type;
+}
+
+bool Si446xSim::CtsPin::digital_read() {
+  // A pin read costs about a microsecond, so polling loops move the virtual clock along
+  host::advance_us(1);
+  this->sim_->update();
+  return this->sim_->gpio_modes_[1] == SI446X_GPIO_MODE_CTS && this->sim_->cts_();
+}
+
+void Si446xSim::shutdown_() {
+  this->shutdown_state_ = true;
+  this->por_active_ = false;
+  this->booted_ = false;
+  this->asleep_ = false;
+  this->state_ = 0;
+  this->phase_ = Phase::IDLE;
+  this->tx_active_ = false;
+  this->tx_fifo_.clear();
+  this->last_tx_.clear();
+  this->rx_fifo_.clear();
+  this->ph_pend_ = 0;
+  this->modem_pend_ = 0;
+  this->chip_pend_ = 0;
+  this->reset_properties_();
+  // The chip is off, the pull-up holds nIRQ high
+  this->update_irq_();
+}
+
+void Si446xSim::release_shutdown_() {
+  this->shutdown_state_ = false;
+  this->por_active_ = true;
+  this->por_end_ = micros() + this->por_us;
+  this->cts_ready_at_ = this->por_end_;
+  this->resets_++;
+}
+
+void Si446xSim::reset_properties_() {
+  for (auto &group : this->properties_) {
+    group.fill(0);
+  }
+  // Power on defaults of the properties that change what the simulation does
+  this->properties_[SI446X_PROP_GROUP_INT_CTL][SI446X_PROP_INT_CTL_ENABLE] = 0x04;
+  this->properties_[SI446X_PROP_GROUP_INT_CTL][SI446X_PROP_INT_CTL_CHIP_ENABLE] = 0x04;
+  this->properties_[SI446X_PROP_GROUP_FRR_CTL][0] = 0x01;
+  this->properties_[SI446X_PROP_GROUP_FRR_CTL][1] = 0x02;
+  this->properties_[SI446X_PROP_GROUP_FRR_CTL][2] = 0x09;
+  // GPIO1 comes out of reset as CTS
+  this->gpio_modes_ = {0x01, SI446X_GPIO_MODE_CTS, 0x01, 0x01};
+}
+
+bool Si446xSim::cts_() const {
+  return this->powered_() && !this->unresponsive_ && !this->asleep_ && time_reached(micros(), this->cts_ready_at_);
+}
+
+void Si446xSim::busy_for_(uint32_t us) { this->cts_ready_at_ = micros() + us; }
+
+void Si446xSim::command_error_() {
+  this->chip_pend_ |= SI446X_CHIP_CMD_ERROR_PEND;
+  this->command_errors_++;
+}
+
+void Si446xSim::update() {
+  const uint32_t now = micros();
+  if (this->por_active_ && time_reached(now, this->por_end_)) {
+    this->por_active_ = false;
+  }
+  if (this->tx_active_ && !this->tx_stuck_ && time_reached(now, this->tx_end_)) {
+    this->tx_active_ = false;
+    this->ph_pend_ |= SI446X_PH_PACKET_SENT_PEND;
+    this->state_ = this->tx_complete_state_ == SI446X_STATE_NO_CHANGE ? SI446X_STATE_READY : this->tx_complete_state_;
+  }
+  this->update_irq_();
+}
+
+void Si446xSim::select() {
+  this->update();
+  this->phase_ = Phase::IDLE;
+  if (!this->powered_()) {
+    this->phase_ = Phase::IGNORE;
+    return;
+  }
+  // Selecting the chip wakes it, CTS stays low until the crystal is running
+  if (this->asleep_) {
+    this->asleep_ = false;
+    this->state_ = SI446X_STATE_SPI_ACTIVE;
+    this->busy_for_(this->wake_us);
+  }
+}
+
+uint8_t Si446xSim::transfer(uint8_t data) {
+  this->update();
+  switch (this->phase_) {
+    case Phase::IDLE:
+      if (data == SI446X_CMD_READ_CMD_BUFF) {
+        this->phase_ = Phase::READ_CTS;
+      } else if (data >= SI446X_CMD_FRR_A_READ && data <= SI446X_CMD_FRR_A_READ + 3) {
+        this->phase_ = Phase::FRR;
+        this->frr_index_ = data - SI446X_CMD_FRR_A_READ;
+      } else if (data == SI446X_CMD_WRITE_TX_FIFO) {
+        this->phase_ = Phase::TX_FIFO;
+      } else if (data == SI446X_CMD_READ_RX_FIFO) {
+        this->phase_ = Phase::RX_FIFO;
+      } else if (!this->cts_()) {
+        // Commands sent while the previous one is still running are thrown away
+        this->command_error_();
+        this->phase_ = Phase::IGNORE;
+      } else {
+        this->phase_ = Phase::COMMAND;
+        this->command_.assign(1, data);
+      }
+      return 0;
+    case Phase::COMMAND:
+      if (this->command_.size() < SI446X_MAX_COMMAND_BYTES) {
+        this->command_.push_back(data);
+      }
+      return 0;
+    case Phase::READ_CTS:
+      if (!this->cts_()) {
+        this->phase_ = Phase::IGNORE;
+        return 0x00;
+      }
+      this->phase_ = Phase::RESPONSE;
+      this->response_index_ = 0;
+      return 0xFF;
+    case Phase::RESPONSE:
+      return this->response_index_ < this->response_.size() ? this->response_[this->response_index_++] : 0;
+    case Phase::FRR:
+      return this->frr_(this->frr_index_++ % 4);
+    case Phase::TX_FIFO:
+      if (this->tx_fifo_.size() == FIFO_SIZE) {
+        this->chip_pend_ |= SI446X_CHIP_FIFO_ERROR_PEND;
+        this->fifo_errors_++;
+      } else {
+        this->tx_fifo_.push_back(data);
+      }
+      return 0;
+    case Phase::RX_FIFO: {
+      if (this->rx_fifo_.empty()) {
+        this->chip_pend_ |= SI446X_CHIP_FIFO_ERROR_PEND;
+        this->fifo_errors_++;
+        return 0;
+      }
+      const uint8_t ret = this->rx_fifo_.front();
+      this->rx_fifo_.erase(this->rx_fifo_.begin());
+      return ret;
+    }
+    case Phase::IGNORE:
+      return 0;
+  }
+  return 0;
+}
+
+void Si446xSim::deselect() {
+  if (this->phase_ == Phase::COMMAND) {
+    this->execute_();
+  }
+  this->phase_ = Phase::IDLE;
+  this->update_irq_();
+}
+
+void Si446xSim::execute_() {
+  const uint8_t opcode = this->command_[0];
+  const uint8_t *args = this->command_.data() + 1;
+  const size_t arg_bytes = this->command_.size() - 1;
+  this->command_counts_[opcode]++;
+  this->response_.fill(0);
+  this->busy_for_(this->command_us);
+
+  // The boot loader only knows these two
+  if (!this->booted_ && opcode != SI446X_CMD_POWER_UP && opcode != SI446X_CMD_PART_INFO) {
+    this->command_error_();
+    return;
+  }
+
+  switch (opcode) {
+    case SI446X_CMD_POWER_UP:
+      this->booted_ = true;
+      this->state_ = SI446X_STATE_READY;
+      this->chip_pend_ |= SI446X_CHIP_READY_PEND;
+      this->busy_for_(this->power_up_us);
+      break;
+    case SI446X_CMD_PART_INFO: {
+      // CHIPREV, PART, PBUILD, ID, CUSTOMER, ROMID
+      const uint8_t info[] = {0x11, 0x44, 0x63, 0x10, 0x00, 0x0A, 0x00, 0x06};
+      std::copy(std::begin(info), std::end(info), this->response_.begin());
+      break;
+    }
+    case SI446X_CMD_SET_PROPERTY: {
+      if (arg_bytes < 3 || args[1] == 0 || args[1] > SI446X_MAX_SET_PROPERTY_PROPS || arg_bytes != 3u + args[1]) {
+        this->command_error_();
+        break;
+      }
+      for (uint8_t i = 0; i < args[1]; i++) {
+        this->properties_[args[0]][static_cast<uint8_t>(args[2] + i)] = args[3 + i];
+      }
+      break;
+    }
+    case SI446X_CMD_GET_PROPERTY: {
+      if (arg_bytes != 3 || args[1] == 0 || args[1] > SI446X_MAX_GET_PROPERTY_PROPS) {
+        this->command_error_();
+        break;
+      }
+      for (uint8_t i = 0; i < args[1]; i++) {
+        this->response_[i] = this->properties_[args[0]][static_cast<uint8_t>(args[2] + i)];
+      }
+      break;
+    }
+    case SI446X_CMD_GPIO_PIN_CFG:
+      for (size_t i = 0; i < 4 && i < arg_bytes; i++) {
+        // Mode 0 leaves the pin alone
+        if ((args[i] & 0x3F) != 0) {
+          this->gpio_modes_[i] = args[i] & 0x3F;
+        }
+      }
+      break;
+    case SI446X_CMD_FIFO_INFO: {
+      const uint8_t arg = arg_bytes > 0 ? args[0] : 0;
+      if (arg & (1 << 1)) {
+        this->rx_fifo_.clear();
+      }
+      if (arg & (1 << 0)) {
+        this->tx_fifo_.clear();
+      }
+      this->response_[0] = this->rx_fifo_.size();
+      this->response_[1] = FIFO_SIZE - this->tx_fifo_.size();
+      break;
+    }
+    case SI446X_CMD_GET_INT_STATUS: {
+      // Reports what was pending, then clears the flags whose argument bit is 0. No arguments clears everything.
+      const uint8_t ph_clear = arg_bytes > 0 ? args[0] : 0;
+      const uint8_t modem_clear = arg_bytes > 1 ? args[1] : 0;
+      const uint8_t chip_clear = arg_bytes > 2 ? args[2] : 0;
+      const uint8_t resp[] = {this->int_pend_(), this->int_pend_(), this->ph_pend_,   this->ph_pend_,
+                              this->modem_pend_, this->modem_pend_, this->chip_pend_, this->chip_pend_};
+      std::copy(std::begin(resp), std::end(resp), this->response_.begin());
+      this->ph_pend_ &= ph_clear;
+      this->modem_pend_ &= modem_clear;
+      this->chip_pend_ &= chip_clear;
+      break;
+    }
+    case SI446X_CMD_GET_MODEM_STATUS: {
+      const uint8_t rssi = this->state_ == SI446X_STATE_RX ? si446x_dbm_to_rssi(this->rssi_dbm_) : 0;
+      const uint8_t resp[] = {this->modem_pend_, this->modem_pend_, rssi, rssi, rssi, rssi, 0, 0};
+      std::copy(std::begin(resp), std::end(resp), this->response_.begin());
+      this->modem_pend_ &= arg_bytes > 0 ? args[0] : 0;
+      break;
+    }
+    case SI446X_CMD_START_TX:
+      this->start_tx_(args, arg_bytes);
+      break;
+    case SI446X_CMD_START_RX:
+      this->start_rx_(args, arg_bytes);
+      break;
+    case SI446X_CMD_CHANGE_STATE:
+      if (arg_bytes < 1) {
+        this->command_error_();
+        break;
+      }
+      this->change_state_(args[0]);
+      break;
+    default:
+      this->command_error_();
+      break;
+  }
+}
+
+void Si446xSim::start_tx_(const uint8_t *args, size_t arg_bytes) {
+  if (arg_bytes < 2) {
+    this->command_error_();
+    return;
+  }
+  const bool retransmit = args[1] & SI446X_START_TX_RETRANSMIT;
+  if (retransmit) {
+    this->tx_fifo_ = this->last_tx_;
+  }
+  if (this->tx_fifo_.empty()) {
+    this->chip_pend_ |= SI446X_CHIP_FIFO_ERROR_PEND;
+    this->fifo_errors_++;
+    return;
+  }
+
+  this->busy_for_(SI446X_START_TX_US);
+  const uint32_t now = micros();
+  this->transmitted_.push_back({.start_us = now,
+                                .frequency_hz = this->frequency_hz(args[0]),
+                                .channel = args[0],
+                                .retransmit = retransmit,
+                                .data = this->tx_fifo_});
+  this->last_tx_ = std::move(this->tx_fifo_);
+  this->tx_fifo_.clear();
+  this->tx_active_ = true;
+  this->tx_end_ = now + this->air_time_us;
+  this->tx_complete_state_ = args[1] >> 4;
+  this->state_ = SI446X_STATE_TX;
+}
+
+void Si446xSim::start_rx_(const uint8_t *args, size_t arg_bytes) {
+  if (arg_bytes < 7) {
+    this->command_error_();
+    return;
+  }
+  this->busy_for_(SI446X_START_RX_US);
+  this->tx_active_ = false;
+  this->rx_channel_ = args[0];
+  this->rx_valid_state_ = args[5];
+  this->state_ = SI446X_STATE_RX;
+}
+
+void Si446xSim::change_state_(uint8_t state) {
+  this->busy_for_(SI446X_CHANGE_STATE_US);
+  if (state == SI446X_STATE_NO_CHANGE) {
+    return;
+  }
+  if (state != SI446X_STATE_TX) {
+    this->tx_active_ = false;
+  }
+  this->state_ = state;
+  if (state == SI446X_STATE_SLEEP) {
+    this->asleep_ = true;
+  }
+}
+
+double Si446xSim::frequency_hz(uint8_t channel) const {
+  const auto &freq_control = this->properties_[SI446X_PROP_GROUP_FREQ_CONTROL];
+  const uint32_t inte = freq_control[0];
+  const uint32_t frac = (freq_control[1] << 16) | (freq_control[2] << 8) | freq_control[3];
+  const uint32_t step = (freq_control[4] << 8) | freq_control[5];
+  const double pfd = 2 * SI446X_XO_HZ / SI446X_OUTDIV;
+  return (inte + (frac + static_cast<double>(channel) * step) / (1 << 19)) * pfd;
+}
+
+bool Si446xSim::receive(const std::vector<uint8_t> &data, double frequency_hz) {
+  this->update();
+  if (!this->powered_() || this->asleep_ || this->state_ != SI446X_STATE_RX ||
+      std::fabs(frequency_hz - this->frequency_hz(this->rx_channel_)) > SI446X_RX_HALF_BANDWIDTH_HZ) {
+    return false;
+  }
+  if (this->rx_fifo_.size() + data.size() > FIFO_SIZE) {
+    this->chip_pend_ |= SI446X_CHIP_FIFO_ERROR_PEND;
+    this->fifo_errors_++;
+    return false;
+  }
+
+  this->rx_fifo_.insert(this->rx_fifo_.end(), data.begin(), data.end());
+  this->ph_pend_ |= SI446X_PH_PACKET_RX_PEND;
+  this->modem_pend_ |= SI446X_MODEM_SYNC_DETECT_PEND;
+  if (this->rx_valid_state_ != SI446X_STATE_NO_CHANGE && this->rx_valid_state_ != SI446X_STATE_RX) {
+    this->change_state_(this->rx_valid_state_);
+  }
+  this->update_irq_();
+  return true;
+}
+
+// INT_PEND: a group is pending when any of its enabled flags is
+uint8_t Si446xSim::int_pend_() const {
+  const auto &int_ctl = this->properties_[SI446X_PROP_GROUP_INT_CTL];
+  uint8_t ret = 0;
+  if (this->ph_pend_ & int_ctl[SI446X_PROP_INT_CTL_PH_ENABLE]) {
+    ret |= 1 << 0;
+  }
+  if (this->modem_pend_ & int_ctl[SI446X_PROP_INT_CTL_MODEM_ENABLE]) {
+    ret |= 1 << 1;
+  }
+  if (this->chip_pend_ & int_ctl[SI446X_PROP_INT_CTL_CHIP_ENABLE]) {
+    ret |= 1 << 2;
+  }
+  return ret;
+}
+
+uint8_t Si446xSim::frr_(uint8_t index) const {
+  const uint8_t mode = this->properties_[SI446X_PROP_GROUP_FRR_CTL][index];
+  // Modes 1-8 are the status and the pending half of INT, PH, MODEM and CHIP, the status reads like the pending half
+  switch (mode) {
+    case SI446X_FRR_INT_STATUS:
+    case SI446X_FRR_INT_STATUS + 1:
+      return this->int_pend_();
+    case SI446X_FRR_INT_STATUS + 2:
+    case SI446X_FRR_INT_STATUS + 3:
+      return this->ph_pend_;
+    case SI446X_FRR_INT_STATUS + 4:
+    case SI446X_FRR_INT_STATUS + 5:
+      return this->modem_pend_;
+    case SI446X_FRR_INT_STATUS + 6:
+    case SI446X_FRR_INT_STATUS + 7:
+      return this->chip_pend_;
+    case SI446X_FRR_CURRENT_STATE:
+      return this->state_;
+    default:
+      return 0;
+  }
+}
+
+void Si446xSim::update_irq_() {
+  const bool low = this->irq_connected_ && this->powered_() &&
+                   (this->int_pend_() & this->properties_[SI446X_PROP_GROUP_INT_CTL][SI446X_PROP_INT_CTL_ENABLE]);
+  if (low == this->nirq_low_) {
+    return;
+  }
+  this->nirq_low_ = low;
+  const auto &pin = this->irq_pin_;
+  if (pin.func_ == nullptr) {
+    return;
+  }
+  if ((low && (pin.type_ & gpio::INTERRUPT_FALLING_EDGE)) || (!low && (pin.type_ & gpio::INTERRUPT_RISING_EDGE))) {
+    pin.func_(pin.arg_);
+  }
+}
+
+}  // namespace temperbridge
+}  // namespace esphome
@@ -0,0 +1,198 @@
+#ifndef TEMPERF_BRIDGE_ALEXA_SI446X_SIM_H
+#define TEMPERF_BRIDGE_ALEXA_SI446X_SIM_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "esphome/components/spi/spi.h"
+#include "esphome/core/gpio.h"
+
+namespace esphome {
+namespace temperbridge {
+
+// A Si4463 as far as the component can tell over SPI, SDN, nIRQ and GPIO1: the command buffer and its CTS handshake,
+// the property store, the FIFOs, START_TX/START_RX with their timing, the interrupt pending registers with nIRQ and
+// the fast response registers. Time comes from micros(), so it follows the host's virtual clock.
+// Not modeled: the modem itself, packet handler CRCs and the wake-up timer.
+class Si446xSim : public spi::SPIHostTarget {
+ public:
+  static const size_t FIFO_SIZE = 64;
+
+  struct Packet {
+    uint32_t start_us;
+    double frequency_hz;
+    // START_TX channel, relative to the frequency programmed in FREQ_CONTROL
+    uint8_t channel;
+    bool retransmit;
+    // Everything that was in the TX FIFO, length byte included
+    std::vector<uint8_t> data;
+  };
+
+  Si446xSim();
+
+  void select() override;
+  void deselect() override;
+  uint8_t transfer(uint8_t data) override;
+
+  // Moves pending events (POR, a packet leaving the air) up to micros() and updates nIRQ. The test driver calls
+  // this every loop iteration, like the real chip would get on with things while the MCU does something else.
+  void update();
+
+  GPIOPin *sdn_pin() { return &this->sdn_pin_; }
+  InternalGPIOPin *irq_pin() { return &this->irq_pin_; }
+  // GPIO1, CTS when configured for it
+  GPIOPin *cts_pin() { return &this->cts_pin_; }
+
+  // A packet from a remote on the given frequency. Returns whether the radio was listening close enough to it.
+  bool receive(const std::vector<uint8_t> &data, double frequency_hz);
+  void set_rssi(int8_t dbm) { this->rssi_dbm_ = dbm; }
+
+  // Faults: CTS never comes back, nIRQ isn't wired, PACKET_SENT never arrives
+  void set_unresponsive(bool unresponsive) { this->unresponsive_ = unresponsive; }
+  void set_irq_connected(bool connected) { this->irq_connected_ = connected; }
+  void set_tx_stuck(bool stuck) { this->tx_stuck_ = stuck; }
+
+  // Timing, in microseconds
+  uint32_t por_us = 5000;
+  uint32_t power_up_us = 5000;
+  uint32_t command_us = 20;
+  uint32_t wake_us = 440;
+  uint32_t air_time_us = 4000;
+
+  const std::vector<Packet> &transmitted() const { return this->transmitted_; }
+  void clear_transmitted() { this->transmitted_.clear(); }
+
+  uint8_t property(uint8_t group, uint8_t prop) const { return this->properties_[group][prop]; }
+  // Carrier for a START_TX/START_RX channel with the current FREQ_CONTROL properties
+  double frequency_hz(uint8_t channel = 0) const;
+  uint8_t state() const { return this->state_; }
+  bool asleep() const { return this->asleep_; }
+  bool nirq() const { return !this->nirq_low_; }
+  uint32_t command_count(uint8_t opcode) const { return this->command_counts_[opcode]; }
+  uint32_t command_errors() const { return this->command_errors_; }
+  uint32_t fifo_errors() const { return this->fifo_errors_; }
+  uint32_t resets() const { return this->resets_; }
+
+ protected:
+  enum class Phase : uint8_t {
+    IDLE,
+    IGNORE,
+    COMMAND,
+    READ_CTS,
+    RESPONSE,
+    FRR,
+    TX_FIFO,
+    RX_FIFO,
+  };
+
+  class SdnPin : public GPIOPin {
+   public:
+    explicit SdnPin(Si446xSim *sim) : sim_(sim) {}
+    void setup() override {}
+    void pin_mode(gpio::Flags flags) override {}
+    bool digital_read() override { return this->value_; }
+    void digital_write(bool value) override;
+
+   protected:
+    Si446xSim *sim_;
+    bool value_{true};
+  };
+
+  class IrqPin : public InternalGPIOPin {
+   public:
+    explicit IrqPin(Si446xSim *sim) : sim_(sim) {}
+    void setup() override {}
+    void pin_mode(gpio::Flags flags) override {}
+    bool digital_read() override;
+    void digital_write(bool value) override {}
+    void attach_interrupt(void (*func)(void *), void *arg, gpio::InterruptType type) const override;
+    void detach_interrupt() const override { this->func_ = nullptr; }
+
+   protected:
+    friend class Si446xSim;
+    Si446xSim *sim_;
+    mutable void (*func_)(void *){nullptr};
+    mutable void *arg_{nullptr};
+    mutable gpio::InterruptType type_{gpio::INTERRUPT_FALLING_EDGE};
+  };
+
+  class CtsPin : public GPIOPin {
+   public:
+    explicit CtsPin(Si446xSim *sim) : sim_(sim) {}
+    void setup() override {}
+    void pin_mode(gpio::Flags flags) override {}
+    bool digital_read() override;
+    void digital_write(bool value) override {}
+
+   protected:
+    Si446xSim *sim_;
+  };
+
+  void shutdown_();
+  void release_shutdown_();
+  void reset_properties_();
+  bool powered_() const { return !this->shutdown_state_ && !this->por_active_; }
+  bool cts_() const;
+  void busy_for_(uint32_t us);
+  void command_error_();
+  void execute_();
+  void start_tx_(const uint8_t *args, size_t arg_bytes);
+  void start_rx_(const uint8_t *args, size_t arg_bytes);
+  void change_state_(uint8_t state);
+  uint8_t int_pend_() const;
+  uint8_t frr_(uint8_t index) const;
+  void update_irq_();
+
+  SdnPin sdn_pin_{this};
+  IrqPin irq_pin_{this};
+  CtsPin cts_pin_{this};
+
+  bool shutdown_state_ = true;
+  bool por_active_ = false;
+  uint32_t por_end_ = 0;
+  // POWER_UP was sent, before that only the boot loader commands work
+  bool booted_ = false;
+  bool asleep_ = false;
+  uint8_t state_ = 0;
+  uint32_t cts_ready_at_ = 0;
+
+  Phase phase_ = Phase::IDLE;
+  std::vector<uint8_t> command_;
+  std::array<uint8_t, 16> response_{};
+  size_t response_index_ = 0;
+  uint8_t frr_index_ = 0;
+
+  std::array<std::array<uint8_t, 256>, 256> properties_{};
+  std::array<uint8_t, 4> gpio_modes_{};
+
+  std::vector<uint8_t> tx_fifo_;
+  std::vector<uint8_t> last_tx_;
+  std::vector<uint8_t> rx_fifo_;
+  bool tx_active_ = false;
+  uint32_t tx_end_ = 0;
+  uint8_t tx_complete_state_ = 0;
+  uint8_t rx_channel_ = 0;
+  uint8_t rx_valid_state_ = 0;
+  int8_t rssi_dbm_ = -120;
+
+  uint8_t ph_pend_ = 0;
+  uint8_t modem_pend_ = 0;
+  uint8_t chip_pend_ = 0;
+  bool nirq_low_ = false;
+
+  bool unresponsive_ = false;
+  bool irq_connected_ = true;
+  bool tx_stuck_ = false;
+
+  std::vector<Packet> transmitted_;
+  std::array<uint32_t, 256> command_counts_{};
+  uint32_t command_errors_ = 0;
+  uint32_t fifo_errors_ = 0;
+  uint32_t resets_ = 0;
+};
+
+}  // namespace temperbridge
+}  // namespace esphome
+
+#endif  // TEMPERF_BRIDGE_ALEXA_SI446X_SIM_H
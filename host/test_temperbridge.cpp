@@ -0,0 +1,804 @@
+// Runs TemperBridgeComponent against the simulated Si446x on virtual time. Every test builds a fresh component and
+// radio, drives loop() the way the ESPHome main loop would and checks what went over the air.
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "si446x.h"
+#include "temperbridge.h"
+#include "si446x_sim.h"
+
+namespace esphome {
+namespace temperbridge {
+
+uint8_t temper_crc(const uint8_t data[], size_t len);
+
+namespace {
+
+int failures = 0;
+
+#define EXPECT(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  } while (0)
+
+#define EXPECT_EQ(a, b) \
+  do { \
+    const auto expect_a_ = (a); \
+    const auto expect_b_ = (b); \
+    if (!(expect_a_ == expect_b_)) { \
+      fprintf(stderr, "%s:%d: expected %s == %s, got %lld and %lld\n", __FILE__, __LINE__, #a, #b, \
+              static_cast<long long>(expect_a_), static_cast<long long>(expect_b_)); \
+      failures++; \
+    } \
+  } while (0)
+
+#define EXPECT_NEAR(a, b, tolerance) \
+  do { \
+    const double expect_a_ = (a); \
+    const double expect_b_ = (b); \
+    if (!(std::fabs(expect_a_ - expect_b_) <= (tolerance))) { \
+      fprintf(stderr, "%s:%d: expected %s near %s, got %f and %f\n", __FILE__, __LINE__, #a, #b, expect_a_, \
+              expect_b_); \
+      failures++; \
+    } \
+  } while (0)
+
+const uint32_t CMD_FLAT = 0x965C0400;
+const uint32_t CMD_SET_MEM_1 = 0x965B0000;
+const uint32_t CMD_STOP = 0x96860000;
+const uint32_t CMD_HEAD_UP = 0x96530005;
+const uint32_t CMD_MASSAGE_CUSTOM = 0x96850000;
+const uint32_t MASSAGE_TYPE_LEG = 0x00000200;
+const uint32_t MASSAGE_LEVEL_STEP = 0x18;
+
+const uint16_t TEST_CHANNEL = 1234;
+const uint16_t MAX_CHANNEL = 10111;
+const uint32_t PACKET_GAP_US = 100000;
+
+// 430 MHz + fc * 156.25 Hz, see temper_channel_fc
+double channel_frequency_hz(uint16_t channel) {
+  const uint32_t fc = channel > 8862 ? 2 * channel + 10658 : channel + 19520;
+  return 430000000.0 + fc * 156.25;
+}
+
+// Length byte, command and channel big endian, CRC
+std::vector<uint8_t> packet_bytes(uint32_t command, uint16_t channel) {
+  std::vector<uint8_t> ret = {7,
+                              static_cast<uint8_t>(command >> 24),
+                              static_cast<uint8_t>(command >> 16),
+                              static_cast<uint8_t>(command >> 8),
+                              static_cast<uint8_t>(command),
+                              static_cast<uint8_t>(channel >> 8),
+                              static_cast<uint8_t>(channel)};
+  ret.push_back(temper_crc(ret.data() + 1, 6));
+  return ret;
+}
+
+struct Decoded {
+  bool valid;
+  uint32_t command;
+  uint16_t channel;
+};
+
+Decoded decode(const Si446xSim::Packet &packet) {
+  const auto &data = packet.data;
+  if (data.size() != 8 || data[0] != 7 || temper_crc(data.data() + 1, 6) != data[7]) {
+    return {false, 0, 0};
+  }
+  return {true, static_cast<uint32_t>(data[1] << 24 | data[2] << 16 | data[3] << 8 | data[4]),
+          static_cast<uint16_t>(data[5] << 8 | data[6])};
+}
+
+bool log_contains(const std::string &text) {
+  for (const auto &line : host::log_lines()) {
+    if (line.find(text) != std::string::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The number following the last log line containing prefix, -1 if there is none
+long long log_value(const std::string &prefix) {
+  const auto &lines = host::log_lines();
+  for (auto it = lines.rbegin(); it != lines.rend(); ++it) {
+    const size_t pos = it->find(prefix);
+    if (pos != std::string::npos) {
+      return strtoll(it->c_str() + pos + prefix.size(), nullptr, 10);
+    }
+  }
+  return -1;
+}
+
+struct Completion {
+  uint32_t id;
+  bool sent;
+  uint32_t at_us;
+};
+
+class Harness {
+ public:
+  explicit Harness(bool cts_pin = false) {
+    host::clear_log();
+    host::seed_random(1);
+    spi::set_host_target(&this->sim);
+    this->bridge.set_interrupt_pin(this->sim.irq_pin());
+    this->bridge.set_sdn_pin(this->sim.sdn_pin());
+    if (cts_pin) {
+      this->bridge.set_cts_pin(this->sim.cts_pin());
+    }
+    // Before setup, like a channel restored from flash. Channel 0 isn't a channel.
+    this->bridge.set_channel(TEST_CHANNEL);
+    this->bridge.add_on_tx_complete_callback(
+        [this](uint32_t id, bool sent) { this->completions.push_back({id, sent, micros()}); });
+  }
+
+  void setup() {
+    this->bridge.setup();
+    this->loop_once();
+  }
+
+  // One pass of the main loop. The loop spins while the component asks for a high frequency loop and runs every
+  // 16 ms otherwise.
+  void loop_once() {
+    this->sim.update();
+    host::run_scheduler();
+    this->bridge.loop();
+    host::advance_us(HighFrequencyLoopRequester::is_high_frequency() ? 50 : 16000);
+  }
+
+  void run_for(uint32_t ms) {
+    const uint32_t start = millis();
+    while (millis() - start < ms) {
+      this->loop_once();
+    }
+  }
+
+  bool run_until(const std::function<bool()> &done, uint32_t timeout_ms) {
+    const uint32_t start = millis();
+    while (!done()) {
+      if (millis() - start > timeout_ms) {
+        return false;
+      }
+      this->loop_once();
+    }
+    return true;
+  }
+
+  const Completion *completion(uint32_t id) const {
+    for (const auto &completion : this->completions) {
+      if (completion.id == id) {
+        return &completion;
+      }
+    }
+    return nullptr;
+  }
+
+  bool run_until_complete(uint32_t id, uint32_t timeout_ms = 5000) {
+    return this->run_until([this, id]() { return this->completion(id) != nullptr; }, timeout_ms);
+  }
+
+  Si446xSim sim;
+  TemperBridgeComponent bridge;
+  std::vector<Completion> completions;
+};
+
+void test_boot_configures_radio() {
+  Harness h;
+  h.setup();
+  EXPECT(!h.bridge.status_has_warning());
+  EXPECT_EQ(h.sim.resets(), 1u);
+  EXPECT_EQ(h.sim.command_errors(), 0u);
+  // FRR A-D report the pending halves
+  EXPECT_EQ(h.sim.property(0x02, 0x00), 0x02);
+  EXPECT_EQ(h.sim.property(0x02, 0x03), 0x08);
+  // nIRQ only for the packet handler, PACKET_RX is on for channel learning even without receive
+  EXPECT_EQ(h.sim.property(0x01, 0x00), 0x01);
+  EXPECT_EQ(h.sim.property(0x01, 0x01), SI446X_PH_PACKET_SENT_PEND | SI446X_PH_PACKET_RX_PEND);
+  // Everything pending at boot was cleared
+  EXPECT(h.sim.nirq());
+  EXPECT_NEAR(h.sim.frequency_hz(), channel_frequency_hz(TEST_CHANNEL), 15.0);
+
+  h.bridge.dump_config();
+  EXPECT(log_contains("part 4463"));
+  EXPECT(!log_contains("Radio is not responding"));
+}
+
+void test_boot_time() {
+  long long without_cts;
+  // Config properties as written one WDS command at a time
+  std::vector<uint8_t> unmerged;
+  {
+    Harness h;
+    h.bridge.set_merge_config_properties(false);
+    h.setup();
+    h.bridge.dump_config();
+    without_cts = log_value("Radio bring-up took ");
+    for (int group = 0; group < 256; group++) {
+      for (int prop = 0; prop < 256; prop++) {
+        unmerged.push_back(h.sim.property(group, prop));
+      }
+    }
+    // Without a CTS pin the whole worst case POR time is waited out
+    EXPECT(log_value("Reset: ") >= 6000);
+  }
+
+  Harness h(true);
+  h.setup();
+  h.bridge.dump_config();
+  EXPECT_EQ(h.sim.command_errors(), 0u);
+  const long long with_cts = log_value("Radio bring-up took ");
+  EXPECT(with_cts > 0);
+  EXPECT(with_cts < without_cts);
+  // The CTS pin lets the first command go as soon as POR is over, give or take one poll backoff
+  EXPECT(log_value("PART_INFO: ") <= h.sim.por_us + 600);
+  EXPECT(with_cts < 20000);
+
+  // Merging the SET_PROPERTY commands leaves the chip configured the same
+  size_t differences = 0;
+  for (int group = 0; group < 256; group++) {
+    for (int prop = 0; prop < 256; prop++) {
+      if (h.sim.property(group, prop) != unmerged[group * 256 + prop]) {
+        differences++;
+      }
+    }
+  }
+  EXPECT_EQ(differences, 0u);
+}
+
+void test_tunes_channels_exactly() {
+  Harness h;
+  h.setup();
+  for (uint16_t channel : {1, 100, 8862, 8863, 10111}) {
+    h.bridge.set_channel(channel);
+    h.loop_once();
+    // FRAC is truncated, one LSB is 14.3 Hz
+    EXPECT_NEAR(h.sim.frequency_hz(), channel_frequency_hz(channel), 15.0);
+  }
+
+  // Setting the channel it's already on writes nothing
+  const uint32_t set_property = h.sim.command_count(SI446X_CMD_SET_PROPERTY);
+  h.bridge.set_channel(10111);
+  h.loop_once();
+  EXPECT_EQ(h.sim.command_count(SI446X_CMD_SET_PROPERTY), set_property);
+  EXPECT_EQ(h.sim.command_errors(), 0u);
+}
+
+void test_property_shadow_matches_chip() {
+  Harness h;
+  h.bridge.set_verify_properties(true);
+  h.setup();
+  for (uint16_t channel : {1, 2, 8862, 10111}) {
+    h.bridge.set_channel(channel);
+    h.loop_once();
+  }
+  // Only the FREQ_CONTROL span that changed is written, each is read back
+  EXPECT(h.sim.command_count(SI446X_CMD_GET_PROPERTY) > 0);
+  EXPECT(!log_contains("expected"));
+}
+
+void test_ez_frequency_programming() {
+  Harness h;
+  h.bridge.set_ez_frequency_programming(true);
+  h.setup();
+
+  for (uint16_t channel : {1000, 1010, 9000}) {
+    h.bridge.set_channel(channel);
+    h.sim.clear_transmitted();
+    const uint32_t set_property = h.sim.command_count(SI446X_CMD_SET_PROPERTY);
+    EXPECT(h.run_until_complete(h.bridge.execute_simple_command(SimpleCommand::SAVE_PRESET_MODE1)));
+    EXPECT(!h.sim.transmitted().empty());
+    for (const auto &packet : h.sim.transmitted()) {
+      EXPECT_NEAR(packet.frequency_hz, channel_frequency_hz(channel), 600.0);
+      EXPECT_EQ(decode(packet).channel, channel);
+    }
+    // 1010 shares its window with 1000, switching to it costs no SPI traffic
+    if (channel == 1010) {
+      EXPECT_EQ(h.sim.command_count(SI446X_CMD_SET_PROPERTY), set_property);
+    }
+  }
+}
+
+void test_sends_repeats() {
+  Harness h;
+  h.setup();
+  const uint32_t queued_at = micros();
+  const uint32_t id = h.bridge.execute_simple_command(SimpleCommand::PRESET_FLAT);
+  EXPECT(id != 0);
+  EXPECT(h.run_until_complete(id));
+
+  const auto &packets = h.sim.transmitted();
+  EXPECT_EQ(packets.size(), 3u);
+  if (packets.size() != 3) {
+    return;
+  }
+  for (size_t i = 0; i < packets.size(); i++) {
+    const Decoded decoded = decode(packets[i]);
+    EXPECT(decoded.valid);
+    EXPECT_EQ(decoded.command, CMD_FLAT);
+    EXPECT_EQ(decoded.channel, TEST_CHANNEL);
+    // Only the first packet goes through the FIFO, the rest are retransmitted
+    EXPECT_EQ(packets[i].retransmit, i != 0);
+    if (i > 0) {
+      const uint32_t gap = packets[i].start_us - packets[i - 1].start_us;
+      // The gap is timed from before the first packet's FIFO load
+      EXPECT(gap >= PACKET_GAP_US - 100);
+      EXPECT(gap < PACKET_GAP_US + 1000);
+    }
+  }
+  // Straight from the action to the air
+  EXPECT(packets[0].start_us - queued_at < 1000);
+
+  const Completion *completion = h.completion(id);
+  EXPECT(completion->sent);
+  // Reported once the last repeat has left the radio, not before
+  EXPECT(completion->at_us - packets[2].start_us >= h.sim.air_time_us);
+  EXPECT_EQ(h.completions.size(), 1u);
+  // Back to the normal loop once the last gap is over
+  h.run_for(150);
+  EXPECT(!HighFrequencyLoopRequester::is_high_frequency());
+  // Without debug_log neither boot nor the packets log anything of their own
+  EXPECT(!log_contains("Processing command"));
+  EXPECT(!log_contains("to TX one packet"));
+
+  h.bridge.dump_metrics(false);
+  EXPECT_EQ(log_value("PACKET_SENT timeouts: "), 0);
+  EXPECT_EQ(h.sim.command_errors(), 0u);
+  EXPECT_EQ(h.sim.fifo_errors(), 0u);
+}
+
+void test_stop_preempts_motion() {
+  Harness h;
+  h.setup();
+  const uint32_t move_id = h.bridge.start_positioning(PositionCommand::RAISE_HEAD);
+  h.run_for(150);
+  EXPECT(!h.sim.transmitted().empty());
+  EXPECT_EQ(decode(h.sim.transmitted().back()).command, CMD_HEAD_UP);
+
+  const uint32_t stop_at = micros();
+  const uint32_t stop_id = h.bridge.execute_simple_command(SimpleCommand::STOP);
+  EXPECT(h.run_until_complete(stop_id));
+  EXPECT(h.completion(stop_id)->sent);
+  EXPECT(h.completion(move_id) != nullptr);
+
+  size_t stops = 0;
+  size_t moves = 0;
+  bool stopped = false;
+  for (const auto &packet : h.sim.transmitted()) {
+    const Decoded decoded = decode(packet);
+    if (decoded.command == CMD_STOP) {
+      if (!stopped) {
+        // At most one inter-packet gap after the STOP was queued
+        EXPECT(packet.start_us - stop_at <= PACKET_GAP_US + 1000);
+      }
+      stopped = true;
+      stops++;
+    } else {
+      EXPECT(!stopped);
+      moves++;
+    }
+  }
+  EXPECT_EQ(stops, 3u);
+  // The move lost its remaining repeats
+  EXPECT(moves < 5);
+}
+
+void test_queue_overflow() {
+  Harness h;
+  h.setup();
+  std::vector<uint32_t> ids;
+  for (int i = 0; i < 20; i++) {
+    ids.push_back(h.bridge.execute_simple_command(SimpleCommand::SAVE_PRESET_MODE1));
+  }
+  // The last four don't fit, they're reported from the next loop
+  EXPECT(h.completions.empty());
+  h.loop_once();
+  EXPECT_EQ(h.completions.size(), 4u);
+  for (size_t i = 16; i < ids.size(); i++) {
+    EXPECT(h.completion(ids[i]) != nullptr && !h.completion(ids[i])->sent);
+  }
+
+  EXPECT(h.run_until_complete(ids[15], 10000));
+  for (size_t i = 0; i < 16; i++) {
+    EXPECT(h.completion(ids[i])->sent);
+  }
+  EXPECT_EQ(h.sim.transmitted().size(), 16u * 3);
+  h.bridge.dump_metrics(false);
+  EXPECT_EQ(log_value("Queue depth: 16 (max "), 16);
+}
+
+void test_coalesces_massage_levels() {
+  Harness h;
+  h.bridge.set_massage_coalesce_window(200);
+  h.setup();
+  const uint32_t first = h.bridge.set_massage_level(MassageTarget::LEGS, 1);
+  const uint32_t second = h.bridge.set_massage_level(MassageTarget::LEGS, 2);
+  const uint32_t third = h.bridge.set_massage_level(MassageTarget::LEGS, 3);
+  EXPECT(h.completion(first) != nullptr && !h.completion(first)->sent);
+  EXPECT(h.completion(second) != nullptr && !h.completion(second)->sent);
+  EXPECT(h.run_until_complete(third));
+  EXPECT(h.completion(third)->sent);
+
+  EXPECT_EQ(h.sim.transmitted().size(), 3u);
+  for (const auto &packet : h.sim.transmitted()) {
+    EXPECT_EQ(decode(packet).command, CMD_MASSAGE_CUSTOM | MASSAGE_TYPE_LEG | 3 * MASSAGE_LEVEL_STEP);
+    // Nothing goes out before the window closes
+    EXPECT(packet.start_us >= 200000);
+  }
+}
+
+void test_stop_cancels_pending_massage() {
+  Harness h;
+  h.bridge.set_massage_coalesce_window(200);
+  h.setup();
+  const uint32_t massage_id = h.bridge.set_massage_level(MassageTarget::HEAD, 4);
+  h.bridge.execute_simple_command(SimpleCommand::STOP);
+  EXPECT(h.completion(massage_id) != nullptr && !h.completion(massage_id)->sent);
+  h.run_for(500);
+  EXPECT_EQ(h.sim.transmitted().size(), 3u);
+  for (const auto &packet : h.sim.transmitted()) {
+    EXPECT((decode(packet).command & 0xFFFF0000) != CMD_MASSAGE_CUSTOM);
+  }
+  // The STOP that ends a timed move does the same
+  h.sim.clear_transmitted();
+  const uint32_t level_id = h.bridge.set_massage_level(MassageTarget::HEAD, 4);
+  const uint32_t stop_id = h.bridge.move_for(PositionCommand::RAISE_LEGS, 500);
+  EXPECT(h.completion(level_id) != nullptr && !h.completion(level_id)->sent);
+  EXPECT_EQ(h.bridge.get_massage_level(MassageTarget::HEAD), 0);
+  EXPECT(h.run_until_complete(stop_id));
+  h.run_for(500);
+  for (const auto &packet : h.sim.transmitted()) {
+    EXPECT((decode(packet).command & 0xFFFF0000) != CMD_MASSAGE_CUSTOM);
+  }
+}
+
+void test_packet_sent_without_nirq() {
+  Harness h;
+  h.sim.set_irq_connected(false);
+  h.setup();
+  const uint32_t id = h.bridge.execute_simple_command(SimpleCommand::PRESET_FLAT);
+  EXPECT(h.run_until_complete(id));
+  EXPECT(h.completion(id)->sent);
+  EXPECT_EQ(h.sim.transmitted().size(), 3u);
+  // The FRR still tells that the packet went out, it's only noticed late
+  h.bridge.dump_metrics(false);
+  EXPECT_EQ(log_value("PACKET_SENT timeouts: "), 0);
+  EXPECT(!log_contains("Timed out waiting for PACKET_SENT"));
+}
+
+void test_packet_sent_timeout() {
+  Harness h;
+  h.setup();
+  h.sim.set_tx_stuck(true);
+  const uint32_t id = h.bridge.execute_simple_command(SimpleCommand::PRESET_FLAT);
+  EXPECT(h.run_until_complete(id));
+  EXPECT_EQ(h.sim.transmitted().size(), 3u);
+  EXPECT(log_contains("Timed out waiting for PACKET_SENT"));
+  h.bridge.dump_metrics(false);
+  EXPECT_EQ(log_value("PACKET_SENT timeouts: "), 3);
+}
+
+void test_cts_timeout_recovers() {
+  Harness h;
+  h.setup();
+  h.sim.set_unresponsive(true);
+  const uint32_t id = h.bridge.execute_simple_command(SimpleCommand::PRESET_FLAT);
+  EXPECT(h.run_until_complete(id));
+  EXPECT(!h.completion(id)->sent);
+  EXPECT(h.sim.transmitted().empty());
+  EXPECT(h.bridge.status_has_warning());
+  EXPECT(log_contains("Timed out waiting for CTS"));
+
+  h.sim.set_unresponsive(false);
+  EXPECT(h.run_until([]() { return log_contains("Radio recovered"); }, 2000));
+  EXPECT(!h.bridge.status_has_warning());
+  EXPECT(h.sim.resets() >= 2u);
+
+  h.sim.clear_transmitted();
+  const uint32_t after = h.bridge.execute_simple_command(SimpleCommand::PRESET_FLAT);
+  EXPECT(h.run_until_complete(after));
+  EXPECT(h.completion(after)->sent);
+  EXPECT_EQ(h.sim.transmitted().size(), 3u);
+}
+
+void test_receive_mirrors_remote() {
+  Harness h;
+  h.bridge.set_receive(true);
+  h.setup();
+  EXPECT_EQ(h.sim.state(), SI446X_STATE_RX);
+
+  const uint32_t command = CMD_MASSAGE_CUSTOM | MASSAGE_TYPE_LEG | 4 * MASSAGE_LEVEL_STEP;
+  EXPECT(h.sim.receive(packet_bytes(command, TEST_CHANNEL), channel_frequency_hz(TEST_CHANNEL)));
+  h.run_for(50);
+  EXPECT_EQ(h.bridge.get_massage_level(MassageTarget::LEGS), 4);
+  // A remote on another channel is far outside the filter
+  EXPECT(!h.sim.receive(packet_bytes(command, TEST_CHANNEL + 1000), channel_frequency_hz(TEST_CHANNEL + 1000)));
+
+  auto corrupted = packet_bytes(CMD_STOP, TEST_CHANNEL);
+  corrupted[7] ^= 0xFF;
+  EXPECT(h.sim.receive(corrupted, channel_frequency_hz(TEST_CHANNEL)));
+  h.run_for(50);
+  EXPECT_EQ(h.bridge.get_massage_level(MassageTarget::LEGS), 4);
+  h.bridge.dump_config();
+  EXPECT_EQ(log_value("Invalid packets: "), 1);
+  EXPECT_EQ(log_value("Dropped packets: "), 0);
+
+  // The base is already where the remote left it
+  h.bridge.set_massage_level(MassageTarget::LEGS, 4);
+  h.run_for(50);
+  EXPECT(h.sim.transmitted().empty());
+
+  // Back to listening once a command has gone out
+  EXPECT(h.run_until_complete(h.bridge.execute_simple_command(SimpleCommand::PRESET_FLAT)));
+  h.run_for(150);
+  EXPECT_EQ(h.sim.transmitted().size(), 3u);
+  EXPECT_EQ(h.sim.state(), SI446X_STATE_RX);
+  EXPECT_EQ(h.sim.command_errors(), 0u);
+  EXPECT_EQ(h.sim.fifo_errors(), 0u);
+}
+
+void test_learns_channel() {
+  const uint16_t remote_channel = 3000;
+  Harness h;
+  h.setup();
+  uint16_t learned = 0;
+  h.bridge.add_on_channel_learned_callback([&learned](uint16_t channel) { learned = channel; });
+  h.bridge.start_channel_learning();
+
+  // The remote is held down, a packet every 50 ms. Every other one names a channel that doesn't exist, which is
+  // never adopted.
+  uint32_t last_press = 0;
+  bool corrupt = true;
+  EXPECT(h.run_until(
+      [&]() {
+        if (millis() - last_press >= 50) {
+          last_press = millis();
+          const uint16_t channel = corrupt ? MAX_CHANNEL + 1 : remote_channel;
+          h.sim.receive(packet_bytes(CMD_FLAT, channel), channel_frequency_hz(remote_channel));
+          corrupt = !corrupt;
+        }
+        return learned != 0;
+      },
+      20000));
+  EXPECT_EQ(learned, remote_channel);
+
+  // Nor set from a lambda
+  h.bridge.set_channel(0);
+  h.bridge.set_channel(MAX_CHANNEL + 1);
+  h.sim.clear_transmitted();
+  EXPECT(h.run_until_complete(h.bridge.execute_simple_command(SimpleCommand::SAVE_PRESET_MODE1)));
+  EXPECT(!h.sim.transmitted().empty());
+  for (const auto &packet : h.sim.transmitted()) {
+    EXPECT_EQ(decode(packet).channel, remote_channel);
+    EXPECT_NEAR(packet.frequency_hz, channel_frequency_hz(remote_channel), 15.0);
+  }
+  // Without receive the radio doesn't stay in RX
+  EXPECT(h.sim.state() != SI446X_STATE_RX);
+}
+
+void test_listen_before_talk() {
+  Harness h;
+  h.bridge.set_lbt_threshold(-90);
+  h.setup();
+  h.sim.set_rssi(-60);
+  const uint32_t busy_id = h.bridge.execute_simple_command(SimpleCommand::SAVE_PRESET_MODE1);
+  EXPECT(h.run_until_complete(busy_id));
+  EXPECT_EQ(h.sim.transmitted().size(), 3u);
+  h.bridge.dump_config();
+  // Each packet backs off five times and then goes out anyway
+  EXPECT_EQ(log_value("Deferrals: "), 15);
+
+  // STOP doesn't wait for the channel
+  h.run_for(150);
+  h.sim.clear_transmitted();
+  const uint32_t stop_at = micros();
+  const uint32_t stop_id = h.bridge.execute_simple_command(SimpleCommand::STOP);
+  EXPECT(h.run_until_complete(stop_id));
+  EXPECT(h.sim.transmitted()[0].start_us - stop_at < 1000);
+
+  // Nor for a packet that is still backing off, which is abandoned
+  h.run_for(150);
+  h.sim.clear_transmitted();
+  const uint32_t deferred_id = h.bridge.execute_simple_command(SimpleCommand::SAVE_PRESET_MODE1);
+  h.run_for(2);
+  EXPECT(h.sim.transmitted().empty());
+  const uint32_t preempt_at = micros();
+  const uint32_t preempt_id = h.bridge.execute_simple_command(SimpleCommand::STOP);
+  EXPECT(h.run_until_complete(preempt_id));
+  EXPECT(!h.completion(deferred_id)->sent);
+  EXPECT_EQ(decode(h.sim.transmitted()[0]).command, CMD_STOP);
+  EXPECT(h.sim.transmitted()[0].start_us - preempt_at < 1000);
+
+  h.bridge.dump_config();
+  const long long deferrals = log_value("Deferrals: ");
+
+  h.sim.set_rssi(-120);
+  h.sim.clear_transmitted();
+  const uint32_t clear_id = h.bridge.execute_simple_command(SimpleCommand::SAVE_PRESET_MODE1);
+  EXPECT(h.run_until_complete(clear_id));
+  EXPECT_EQ(h.sim.transmitted().size(), 3u);
+  h.bridge.dump_config();
+  EXPECT_EQ(log_value("Deferrals: "), deferrals);
+  EXPECT_EQ(decode(h.sim.transmitted()[0]).command, CMD_SET_MEM_1);
+}
+
+void test_sleeps_when_idle() {
+  Harness h;
+  h.bridge.set_idle_sleep_time(500);
+  h.setup();
+  h.run_for(600);
+  EXPECT(h.sim.asleep());
+
+  const uint32_t id = h.bridge.execute_simple_command(SimpleCommand::PRESET_FLAT);
+  EXPECT(h.run_until_complete(id));
+  EXPECT(h.completion(id)->sent);
+  EXPECT_EQ(h.sim.transmitted().size(), 3u);
+  // Idle from the end of the last gap
+  h.run_for(700);
+  EXPECT(h.sim.asleep());
+  EXPECT_EQ(h.sim.command_errors(), 0u);
+
+  h.bridge.dump_metrics(false);
+  EXPECT_EQ(log_value("Sleeps: "), 2);
+  EXPECT_EQ(log_value("Wake to TX: count="), 1);
+}
+
+void test_tracks_position() {
+  Harness h;
+  h.bridge.set_travel_time(PositionAxis::HEAD, 2000);
+  h.setup();
+  EXPECT(std::isnan(h.bridge.get_position(PositionAxis::HEAD)));
+
+  EXPECT(h.run_until_complete(h.bridge.move_to_position(PositionAxis::HEAD, 0.0f), 10000));
+  EXPECT_EQ(h.bridge.get_position(PositionAxis::HEAD), 0.0f);
+
+  EXPECT(h.run_until_complete(h.bridge.move_to_position(PositionAxis::HEAD, 0.5f), 10000));
+  // Packets go out on a 100 ms grid, so the move is off by at most one gap
+  EXPECT_NEAR(h.bridge.get_position(PositionAxis::HEAD), 0.5, 0.06);
+}
+
+void test_traces_spi() {
+  Harness h;
+  h.setup();
+  EXPECT(h.run_until_complete(h.bridge.execute_simple_command(SimpleCommand::PRESET_FLAT)));
+  host::clear_log();
+  h.bridge.dump_trace();
+  // Nothing overwritten yet, so every transaction since boot is there
+  const long long count = log_value("SPI trace: ");
+  EXPECT(count > 0 && count < static_cast<long long>(SPI_TRACE_ENTRIES));
+  EXPECT_EQ(log_value(" entries, "), count);
+
+  std::vector<SpiTraceEntry> entries;
+  for (const auto &line : host::log_lines()) {
+    const size_t pos = line.find("trace: ");
+    if (pos == std::string::npos || line.find("SPI trace: ") != std::string::npos) {
+      continue;
+    }
+    const std::string hex = line.substr(pos + strlen("trace: "));
+    for (size_t i = 0; i + 2 * sizeof(SpiTraceEntry) <= hex.size(); i += 2 * sizeof(SpiTraceEntry)) {
+      SpiTraceEntry entry;
+      auto *bytes = reinterpret_cast<uint8_t *>(&entry);
+      for (size_t j = 0; j < sizeof(SpiTraceEntry); j++) {
+        bytes[j] = strtoul(hex.substr(i + 2 * j, 2).c_str(), nullptr, 16);
+      }
+      entries.push_back(entry);
+    }
+  }
+  EXPECT_EQ(static_cast<long long>(entries.size()), count);
+  size_t fifo_loads = 0;
+  for (size_t i = 0; i < entries.size(); i++) {
+    // Oldest first
+    EXPECT(i == 0 || static_cast<int32_t>(entries[i].timestamp_us - entries[i - 1].timestamp_us) >= 0);
+    if (entries[i].opcode == SI446X_CMD_WRITE_TX_FIFO) {
+      EXPECT_EQ(entries[i].length, 1 + sizeof(TemperPacket));
+      fifo_loads++;
+    }
+  }
+  // Only the first repeat goes through the FIFO
+  EXPECT_EQ(fifo_loads, 1u);
+}
+
+// The end of an automation, records when it was reached
+class RecordAction : public Action<> {
+ public:
+  std::vector<uint32_t> played_at;
+
+ protected:
+  void play() override { this->played_at.push_back(micros()); }
+};
+
+void test_action_sequence() {
+  Harness h;
+  ExecuteSimpleCommandAction<> flat;
+  flat.set_parent(&h.bridge);
+  flat.set_cmd(SimpleCommand::PRESET_FLAT);
+  PositionCommandAction<> raise;
+  raise.set_parent(&h.bridge);
+  raise.set_cmd(PositionCommand::RAISE_HEAD);
+  raise.set_duration(500);
+  RecordAction done;
+  flat.set_next(&raise);
+  raise.set_next(&done);
+  h.setup();
+
+  // The second action is played from inside the first one's TX complete callback
+  flat.play_complex();
+  EXPECT(h.run_until([&done]() { return !done.played_at.empty(); }, 5000));
+  EXPECT_EQ(done.played_at.size(), 1u);
+  EXPECT(!flat.is_running());
+  EXPECT(!raise.is_running());
+
+  const auto &packets = h.sim.transmitted();
+  EXPECT(packets.size() > 6);
+  if (packets.size() <= 6) {
+    return;
+  }
+  for (size_t i = 0; i < 3; i++) {
+    EXPECT_EQ(decode(packets[i]).command, CMD_FLAT);
+  }
+  // The move only starts once FLAT is done, and the sequence only ends once the move's STOP is
+  EXPECT_EQ(decode(packets[3]).command, CMD_HEAD_UP);
+  EXPECT_EQ(decode(packets.back()).command, CMD_STOP);
+  EXPECT(done.played_at[0] - packets.back().start_us >= h.sim.air_time_us);
+}
+
+struct Test {
+  const char *name;
+  void (*run)();
+};
+
+const Test TESTS[] = {
+    {"boot_configures_radio", test_boot_configures_radio},
+    {"boot_time", test_boot_time},
+    {"tunes_channels_exactly", test_tunes_channels_exactly},
+    {"property_shadow_matches_chip", test_property_shadow_matches_chip},
+    {"ez_frequency_programming", test_ez_frequency_programming},
+    {"sends_repeats", test_sends_repeats},
+    {"stop_preempts_motion", test_stop_preempts_motion},
+    {"queue_overflow", test_queue_overflow},
+    {"coalesces_massage_levels", test_coalesces_massage_levels},
+    {"stop_cancels_pending_massage", test_stop_cancels_pending_massage},
+    {"packet_sent_without_nirq", test_packet_sent_without_nirq},
+    {"packet_sent_timeout", test_packet_sent_timeout},
+    {"cts_timeout_recovers", test_cts_timeout_recovers},
+    {"receive_mirrors_remote", test_receive_mirrors_remote},
+    {"learns_channel", test_learns_channel},
+    {"listen_before_talk", test_listen_before_talk},
+    {"sleeps_when_idle", test_sleeps_when_idle},
+    {"tracks_position", test_tracks_position},
+    {"traces_spi", test_traces_spi},
+    {"action_sequence", test_action_sequence},
+};
+
+}  // namespace
+}  // namespace temperbridge
+}  // namespace esphome
+
+int main(int argc, char **argv) {
+  using namespace esphome::temperbridge;
+  int failed_tests = 0;
+  int run = 0;
+  for (const Test &test : TESTS) {
+    if (argc > 1 && strcmp(argv[1], test.name) != 0) {
+      continue;
+    }
+    const int before = failures;
+    test.run();
+    run++;
+    if (failures != before) {
+      failed_tests++;
+      printf("FAIL %s\n", test.name);
+    } else {
+      printf("ok   %s\n", test.name);
+    }
+  }
+  printf("%d of %d tests passed\n", run - failed_tests, run);
+  return failed_tests == 0 && run > 0 ? 0 : 1;
+}
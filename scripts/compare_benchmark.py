@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""Compares temperbridge benchmark results against a stored baseline.
+
+The results are the JSON line that dump_config logs with benchmark: true. Pass either a device log, which is
+scraped for the last such line, or the JSON file written by the host benchmark:
+
+    esphome logs bridge.yaml | tee bridge.log
+    python3 scripts/compare_benchmark.py esp32_baseline.json bridge.log
+
+    make -C host bench
+
+Exits with status 1 when any path got slower than the baseline by more than the tolerance. Baselines only mean
+something for the hardware they were measured on.
+"""
+
+import argparse
+import json
+import re
+import sys
+
+BENCHMARK_LINE = re.compile(r"Benchmark: (\{.*\})")
+
+
+def load_results(path):
+    with open(path) as file:
+        text = file.read()
+    matches = BENCHMARK_LINE.findall(text)
+    if matches:
+        return json.loads(matches[-1])
+    try:
+        return json.loads(text)
+    except ValueError:
+        sys.exit(f"{path}: no benchmark results found")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline", help="baseline JSON file")
+    parser.add_argument("results", help="device log or JSON file with the new results")
+    parser.add_argument(
+        "--tolerance",
+        type=float,
+        default=0.25,
+        help="allowed slowdown as a fraction of the baseline (default %(default)s)",
+    )
+    parser.add_argument(
+        "--slack-ns",
+        type=int,
+        default=2,
+        help="allowed slowdown in ns on top of that, the timings are only accurate to a few ns "
+        "(default %(default)s)",
+    )
+    parser.add_argument(
+        "--update", action="store_true", help="write the results to the baseline instead of comparing"
+    )
+    args = parser.parse_args()
+
+    results = load_results(args.results)
+    if args.update:
+        with open(args.baseline, "w") as file:
+            json.dump(results, file, indent=2, sort_keys=True)
+            file.write("\n")
+        return
+
+    baseline = load_results(args.baseline)
+    regressions = []
+    print(f"{'path':<18} {'baseline':>10} {'current':>10} {'change':>8}")
+    for name in sorted(baseline):
+        expected = baseline[name]
+        if name not in results:
+            print(f"{name:<18} {expected:>10} {'missing':>10}")
+            regressions.append(name)
+            continue
+        current = results[name]
+        change = (current - expected) / expected * 100 if expected else 0.0
+        limit = expected * (1 + args.tolerance) + args.slack_ns
+        flag = "  REGRESSION" if current > limit else ""
+        print(f"{name:<18} {expected:>10} {current:>10} {change:>+7.1f}%{flag}")
+        if flag:
+            regressions.append(name)
+
+    if regressions:
+        sys.exit(f"slower than the baseline or missing: {', '.join(regressions)}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""Turns the output of temperbridge.dump_trace into a readable SPI timeline.
+
+Feed it the device log, for example:
+
+    esphome logs bridge.yaml | tee bridge.log
+    python3 scripts/decode_trace.py bridge.log
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+# Matches SpiTraceEntry in temperbridge.h: timestamp_us, opcode, length, cts_polls, flags
+ENTRY = struct.Struct("<IBBBB")
+
+FLAG_RESPONSE = 1 << 0
+FLAG_CTS_TIMEOUT = 1 << 1
+
+OPCODES = {
+    0x01: "PART_INFO",
+    0x11: "SET_PROPERTY",
+    0x12: "GET_PROPERTY",
+    0x13: "GPIO_PIN_CFG",
+    0x15: "FIFO_INFO",
+    0x20: "GET_INT_STATUS",
+    0x22: "GET_MODEM_STATUS",
+    0x31: "START_TX",
+    0x32: "START_RX",
+    0x34: "CHANGE_STATE",
+    0x44: "READ_CMD_BUFF",
+    0x50: "FRR_A_READ",
+    0x66: "WRITE_TX_FIFO",
+    0x77: "READ_RX_FIFO",
+}
+
+TRACE_LINE = re.compile(r"\]: trace: ([0-9a-f]{16,})")
+
+
+def parse(lines):
+    entries = []
+    for line in lines:
+        match = TRACE_LINE.search(line)
+        if not match:
+            continue
+        data = bytes.fromhex(match.group(1))
+        for offset in range(0, len(data) - ENTRY.size + 1, ENTRY.size):
+            entries.append(ENTRY.unpack_from(data, offset))
+    # dump_trace logs a snapshot of the ring, oldest entry first
+    return entries
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", nargs="?", help="log file, stdin when omitted")
+    args = parser.parse_args()
+
+    with open(args.log) if args.log else sys.stdin as log:
+        entries = parse(log)
+    if not entries:
+        sys.exit("no trace lines found")
+
+    first = entries[0][0]
+    previous = first
+    print(f"{'time us':>10} {'delta us':>9}  {'command':<17} {'len':>3} {'cts':>4}  flags")
+    for timestamp, opcode, length, cts_polls, flags in entries:
+        name = OPCODES.get(opcode, f"0x{opcode:02x}")
+        notes = []
+        if flags & FLAG_RESPONSE:
+            notes.append("response")
+        if flags & FLAG_CTS_TIMEOUT:
+            notes.append("CTS TIMEOUT")
+        cts = "255+" if cts_polls == 0xFF else str(cts_polls)
+        relative = (timestamp - first) & 0xFFFFFFFF
+        delta = (timestamp - previous) & 0xFFFFFFFF
+        print(f"{relative:>10} {delta:>9}  {name:<17} {length:>3} {cts:>4}  {' '.join(notes)}")
+        previous = timestamp
+
+
+if __name__ == "__main__":
+    main()
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "si446x.h"
 #include "esphome/core/log.h"
 
@@ -7,6 +9,16 @@ namespace temperbridge {
 static const char *const TAG = "temperbridge";
 
 void Si446xGetIntStatusResp::print() {
+  Si446xIntPend pend = {
+      .int_pend = this->int_pend,
+      .ph_pend = this->ph_pend,
+      .modem_pend = this->modem_pend,
+      .chip_pend = this->chip_pend,
+  };
+  pend.print();
+}
+
+void Si446xIntPend::print() {
   if (this->int_pend != 0) {
     ESP_LOGI(TAG, "interrupt pend:");
     if (this->int_pend & (1 << 2))
@@ -76,5 +88,72 @@ void Si446xGetIntStatusResp::print() {
   }
 }
 
+Si446xWutConfig si446x_wut_config(uint32_t period_ms, uint32_t window_ms) {
+  // 8192 timer ticks per second at R = 0
+  const uint64_t period_ticks = (uint64_t) period_ms * 8192;
+  const uint64_t window_ticks = (uint64_t) window_ms * 8192;
+  uint8_t r = 0;
+  while (r < 31 && (period_ticks / (1000ull << r) > 0xFFFF || window_ticks / (1000ull << r) > 0xFF)) {
+    r++;
+  }
+
+  const uint64_t unit = 1000ull << r;
+  Si446xWutConfig ret;
+  ret.r = r;
+  ret.m = std::max<uint64_t>(1, (period_ticks + unit / 2) / unit);
+  // Rounded up, a window that is too short misses packets
+  ret.ldc = std::max<uint64_t>(1, std::min<uint64_t>(0xFF, (window_ticks + unit - 1) / unit));
+  return ret;
+}
+
+size_t Si446xPropertyShadow::lower_bound_(uint16_t key) const {
+  size_t low = 0;
+  size_t high = this->count_;
+  while (low < high) {
+    const size_t mid = (low + high) / 2;
+    if (this->keys_[mid] < key) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+bool Si446xPropertyShadow::store(uint8_t group, uint8_t prop, uint8_t value) {
+  const uint16_t key = (group << 8) | prop;
+  const size_t index = this->lower_bound_(key);
+  if (index < this->count_ && this->keys_[index] == key) {
+    this->values_[index] = value;
+    return true;
+  }
+  if (this->count_ == CAPACITY) {
+    return false;
+  }
+  for (size_t i = this->count_; i > index; i--) {
+    this->keys_[i] = this->keys_[i - 1];
+    this->values_[i] = this->values_[i - 1];
+  }
+  this->keys_[index] = key;
+  this->values_[index] = value;
+  this->count_++;
+  return true;
+}
+
+bool Si446xPropertyShadow::load(uint8_t group, uint8_t prop, uint8_t *value) const {
+  const uint16_t key = (group << 8) | prop;
+  const size_t index = this->lower_bound_(key);
+  if (index == this->count_ || this->keys_[index] != key) {
+    return false;
+  }
+  *value = this->values_[index];
+  return true;
+}
+
+bool Si446xPropertyShadow::matches(uint8_t group, uint8_t prop, uint8_t value) const {
+  uint8_t current;
+  return this->load(group, prop, &current) && current == value;
+}
+
 }  // namespace temperbridge
-}  // namespace esphome
\ No newline at end of file
+}  // namespace esphome
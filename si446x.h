@@ -1,17 +1,61 @@
 #ifndef TEMPERF_BRIDGE_ALEXA_SI446X_H
 #define TEMPERF_BRIDGE_ALEXA_SI446X_H
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
 
 #define SI446X_CMD_PART_INFO 0x01
 #define SI446X_CMD_SET_PROPERTY 0x11
 #define SI446X_CMD_GET_PROPERTY 0x12
+#define SI446X_CMD_GPIO_PIN_CFG 0x13
 #define SI446X_CMD_FIFO_INFO 0x15
 #define SI446X_CMD_GET_INT_STATUS 0x20
+#define SI446X_CMD_GET_MODEM_STATUS 0x22
 #define SI446X_CMD_START_TX 0x31
+#define SI446X_CMD_START_RX 0x32
+#define SI446X_CMD_CHANGE_STATE 0x34
 #define SI446X_CMD_WRITE_TX_FIFO 0x66
 #define SI446X_CMD_READ_CMD_BUFF 0x44
 #define SI446X_CMD_FRR_A_READ 0x50
+#define SI446X_CMD_READ_RX_FIFO 0x77
+
+#define SI446X_PROP_GROUP_GLOBAL 0x00
+#define SI446X_PROP_GLOBAL_CLK_CFG 0x01
+#define SI446X_PROP_GLOBAL_WUT_CONFIG 0x04
+#define SI446X_PROP_GROUP_INT_CTL 0x01
+#define SI446X_PROP_INT_CTL_PH_ENABLE 0x01
+#define SI446X_PROP_GROUP_FREQ_CONTROL 0x40
+#define SI446X_PROP_FREQ_CONTROL_INTE 0x00
+
+#define SI446X_STATE_NO_CHANGE 0x00
+// SLEEP while the 32 kHz oscillator runs for the wake-up timer, STANDBY otherwise
+#define SI446X_STATE_SLEEP 0x01
+#define SI446X_STATE_READY 0x03
+#define SI446X_STATE_RX 0x08
+
+#define SI446X_MAX_SET_PROPERTY_PROPS 12
+#define SI446X_MAX_GET_PROPERTY_PROPS 16
+// Longest command the chip accepts, opcode included
+#define SI446X_MAX_COMMAND_BYTES 16
+#define SI446X_MAX_EZ_CHANNEL 255
+
+#define SI446X_START_TX_RETRANSMIT (1 << 2)
+
+#define SI446X_GPIO_MODE_CTS 0x08
+
+#define SI446X_CLK_32K_SEL_RC 0x01
+#define SI446X_WUT_CONFIG_LDC_RX (1 << 6)
+#define SI446X_WUT_CONFIG_WUT_EN (1 << 1)
+#define SI446X_WUT_CONFIG_CAL_EN (1 << 0)
+// In GLOBAL_WUT_R, go back to SLEEP rather than READY when the timer expires
+#define SI446X_WUT_R_SLEEP (1 << 5)
+
+#define SI446X_PH_PACKET_SENT_PEND (1 << 5)
+#define SI446X_PH_PACKET_RX_PEND (1 << 4)
+
+#define SI446X_CHIP_FIFO_ERROR_PEND (1 << 5)
+#define SI446X_CHIP_CMD_ERROR_PEND (1 << 3)
 
 namespace esphome {
 namespace temperbridge {
@@ -25,6 +69,16 @@ struct Si446xChipInfoResp {
   uint8_t romid;
 } __attribute__((packed));
 
+// The pending half of the interrupt status. RF_FRR_CTL_A_MODE_4 maps FRR A-D to exactly these, in this order.
+struct Si446xIntPend {
+  uint8_t int_pend;
+  uint8_t ph_pend;
+  uint8_t modem_pend;
+  uint8_t chip_pend;
+
+  void print();
+} __attribute__((packed));
+
 struct Si446xGetIntStatusResp {
   uint8_t int_pend;
   uint8_t int_status;
@@ -38,6 +92,30 @@ struct Si446xGetIntStatusResp {
   void print();
 } __attribute__((packed));
 
+struct Si446xModemStatusResp {
+  uint8_t modem_pend;
+  uint8_t modem_status;
+  uint8_t curr_rssi;
+  uint8_t latch_rssi;
+  uint8_t ant1_rssi;
+  uint8_t ant2_rssi;
+  uint16_t afc_freq_offset;
+} __attribute__((packed));
+
+// RSSI readings are in 0.5 dB steps, offset by MODEM_RSSI_COMP (left at its default) and the front end gain
+inline uint8_t si446x_dbm_to_rssi(int8_t dbm) { return (dbm + 134) * 2; }
+inline int si446x_rssi_to_dbm(uint8_t rssi) { return rssi / 2 - 134; }
+
+// GLOBAL_WUT_R/M/LDC for a wake-up period and an RX window in it. The timer runs at 32768 / (4 * 2^R) Hz, R is
+// picked as small as the 16 bit M and 8 bit LDC allow.
+struct Si446xWutConfig {
+  uint8_t r;
+  uint16_t m;
+  uint8_t ldc;
+};
+
+Si446xWutConfig si446x_wut_config(uint32_t period_ms, uint32_t window_ms);
+
 struct Si446xFifoInfoResp {
   uint8_t rx_fifo_count;
   uint8_t tx_fifo_space;
@@ -55,6 +133,30 @@ struct Si446xSetPropertyArgs {
   uint8_t start_prop;
 } __attribute__((packed));
 
+// RAM copy of the properties known to be in the chip, so unchanged values don't have to be written again and
+// written ones don't have to be read back. Properties that were never written aren't known.
+class Si446xPropertyShadow {
+ public:
+  static const size_t CAPACITY = 256;
+
+  // Returns false when the shadow is full, the property then just stays unknown
+  bool store(uint8_t group, uint8_t prop, uint8_t value);
+  bool load(uint8_t group, uint8_t prop, uint8_t *value) const;
+  bool matches(uint8_t group, uint8_t prop, uint8_t value) const;
+
+  void clear() { this->count_ = 0; }
+  size_t size() const { return this->count_; }
+
+ protected:
+  // Index of the first key not less than key
+  size_t lower_bound_(uint16_t key) const;
+
+  // Sorted by group << 8 | prop
+  std::array<uint16_t, CAPACITY> keys_{};
+  std::array<uint8_t, CAPACITY> values_{};
+  size_t count_ = 0;
+};
+
 }  // namespace temperbridge
 }  // namespace esphome
 
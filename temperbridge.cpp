@@ -1,5 +1,7 @@
 #include <cstring>
 #include <cinttypes>
+#include <cmath>
+#include <cstdio>
 
 #include "esphome/core/helpers.h"
 #include "si446x.h"
@@ -14,79 +16,489 @@ static const char *const TAG = "temperbridge";
 
 const uint8_t SI4463_RADIO_CONFIGURATION_DATA_ARRAY[] = RADIO_CONFIGURATION_DATA_ARRAY;
 
+// WRITE_TX_FIFO, length byte, packet
+static const size_t TEMPER_TX_FIFO_WRITE_BYTES = 2 + sizeof(TemperPacket);
+
+// Listen-before-talk: time for the RSSI reading to settle after entering RX, and the random backoff range after
+// finding the channel busy. After this many deferrals the packet goes out anyway.
+static const uint32_t TEMPER_LBT_RSSI_SETTLE_US = 1000;
+static const uint32_t TEMPER_LBT_MIN_BACKOFF_US = 10000;
+static const uint32_t TEMPER_LBT_MAX_BACKOFF_US = 50000;
+static const uint8_t TEMPER_LBT_MAX_DEFERRALS = 5;
+
+// Named timeouts used to coalesce massage level changes, indexed by MassageTarget
+static const char *const MASSAGE_COALESCE_TIMEOUTS[] = {"massage_head", "massage_legs", "massage_lumbar"};
+
+// Channels are 1..TEMPER_MAX_CHANNEL, there is no channel 0
+static const uint16_t TEMPER_MAX_CHANNEL = 10111;
+
+static bool temper_valid_channel(uint16_t channel) { return channel >= 1 && channel <= TEMPER_MAX_CHANNEL; }
+
+// Time from the start of one packet to the start of the next one
+static const uint32_t TEMPER_INTER_PACKET_GAP_US = 100000;
+// Give up waiting for PACKET_SENT after this long
+static const uint32_t TEMPER_PACKET_SENT_TIMEOUT_US = 50000;
+
+// Spin on CTS this long before backing off, most commands complete well within it
+static const uint32_t SI446X_CTS_SPIN_US = 50;
+static const uint32_t SI446X_CTS_MAX_BACKOFF_US = 500;
+// Past this point give the rest of the system a chance to run between polls
+static const uint32_t SI446X_CTS_YIELD_AFTER_US = 2000;
+static const uint32_t RADIO_RECOVERY_INTERVAL_MS = 1000;
+#ifdef USE_TEMPERBRIDGE_RADIO_TASK
+static const uint32_t TEMPER_RADIO_TASK_STACK_SIZE = 4096;
+// Above the loop task so packets keep their timing while the loop task is busy with the API or logging. Still below
+// the WiFi and lwIP tasks, which can preempt it for a few ms at a time, well within the 100 ms packet gap.
+static const UBaseType_t TEMPER_RADIO_TASK_PRIORITY = 5;
+// The loop task runs on the last core, keep the radio on the other one when there is one. That is the core WiFi runs
+// on, the point is getting away from the loop task, not from WiFi.
+#if portNUM_PROCESSORS > 1
+static const BaseType_t TEMPER_RADIO_TASK_CORE = 0;
+#else
+static const BaseType_t TEMPER_RADIO_TASK_CORE = tskNO_AFFINITY;
+#endif
+#endif
+// SDN must be held high for at least 10 us to reset the chip
+static const uint32_t SI446X_SDN_PULSE_US = 10;
+// Worst case power on reset time after SDN is released
+static const uint32_t SI446X_POR_US = 6000;
+
 void TemperBridgeComponent::setup() {
   this->interrupt_pin_->pin_mode(gpio::FLAG_INPUT);
   this->interrupt_pin_->setup();
 
-  // this->store_.pin = this->interrupt_pin_->to_isr();
-
   this->sdn_pin_->pin_mode(gpio::FLAG_OUTPUT);
   this->sdn_pin_->setup();
 
+  if (this->cts_pin_ != nullptr) {
+    this->cts_pin_->pin_mode(gpio::FLAG_INPUT);
+    this->cts_pin_->setup();
+  }
+
   this->spi_setup();
 
   Component::setup();
 
+  if (!this->radio_init_()) {
+    ESP_LOGE(TAG, "Radio did not come up, will keep retrying");
+  }
+
+  // nIRQ is released now that everything pending has been cleared, so the next falling edge is a new event
+  this->store_.pin = this->interrupt_pin_->to_isr();
+  this->interrupt_pin_->attach_interrupt(TemperBridgeStore::gpio_intr, &this->store_, gpio::INTERRUPT_FALLING_EDGE);
+
+  this->initialized_ = true;
+
+#ifdef USE_TEMPERBRIDGE_BENCHMARK
+  this->run_benchmark_();
+#endif
+
+#ifdef USE_SENSOR
+  this->set_interval("metrics", this->metrics_update_interval_, [this]() { this->publish_metrics_(); });
+#endif
+
+#ifdef USE_TEMPERBRIDGE_RADIO_TASK
+  // From here on the radio belongs to the task, the loop task only hands it messages
+  if (xTaskCreatePinnedToCore(TemperBridgeComponent::radio_task_, "temperbridge", TEMPER_RADIO_TASK_STACK_SIZE, this,
+                              TEMPER_RADIO_TASK_PRIORITY, &this->store_.task, TEMPER_RADIO_TASK_CORE) != pdPASS) {
+    ESP_LOGE(TAG, "Could not start the radio task, running the radio from the main loop");
+    this->store_.task = nullptr;
+  }
+#endif
+}
+
+bool TemperBridgeComponent::radio_init_() {
+  this->radio_fault_ = false;
+  this->asleep_ = false;
+  this->wake_pending_tx_ = false;
+  this->idle_start_ = millis();
+  this->boot_timing_ = {};
+  const uint32_t start = micros();
+  uint32_t phase_start = start;
+
   this->sdn_pin_->digital_write(true);
-  delay(10);
+  delayMicroseconds(SI446X_SDN_PULSE_US);
   this->sdn_pin_->digital_write(false);
-  delay(20);
+  // With a CTS pin the first command is simply gated on POR finishing, without one the SPI interface
+  // can't be trusted to report CTS until POR is over
+  if (this->cts_pin_ == nullptr) {
+    delayMicroseconds(SI446X_POR_US);
+  }
+  this->boot_timing_.reset_us = micros() - phase_start;
+  phase_start = micros();
 
-  const Si446xChipInfoResp resp = si446x_part_info_();
-  ESP_LOGCONFIG(TAG, "part %x", resp.part);
-  ESP_LOGCONFIG(TAG, "rev %x", resp.chiprev);
-  // https://community.silabs.com/s/article/using-part-info-command-to-identify-ezradio-pro-part-number?language=en_US
-  ESP_LOGCONFIG(TAG, "romid %x", resp.romid);
-  ESP_LOGCONFIG(TAG, "prbuild %x", resp.prbuild);
+  this->chip_info_ = si446x_part_info_();
+  this->boot_timing_.part_info_us = micros() - phase_start;
+  phase_start = micros();
 
+  // Everything the chip held was lost with the reset
+  this->property_shadow_.clear();
   si446x_configuration_init_(SI4463_RADIO_CONFIGURATION_DATA_ARRAY);
 
   Si446xGetIntStatusResp int_status;
   si446x_get_int_status(&int_status, true);
   //int_status.print();
+  this->boot_timing_.config_us = micros() - phase_start;
+  phase_start = micros();
 
-  this->initialized_ = true;
+  this->tuned_channel_valid_ = false;
+  this->select_channel_(this->channel_);
+  this->boot_timing_.tune_us = micros() - phase_start;
+
+  // PACKET_RX is harmless while the radio never enters RX, and channel learning needs it even without receive
+  Si446xSetPropertyArgs args = {
+      .group = SI446X_PROP_GROUP_INT_CTL,
+      .num_props = 1,
+      .start_prop = SI446X_PROP_INT_CTL_PH_ENABLE,
+  };
+  uint8_t ph_enable = SI446X_PH_PACKET_SENT_PEND | SI446X_PH_PACKET_RX_PEND;
+  si446x_set_property_(&args, &ph_enable);
+
+  this->rx_active_ = false;
+  if (this->receive_ || this->learning_) {
+    this->start_rx_(this->listen_channel_());
+  }
 
-  this->tune_channel_(this->channel_);
+  this->boot_timing_.total_us = micros() - start;
+
+  return !this->radio_fault_;
 }
 
-void TemperBridgeComponent::si446x_raw_command_(const uint8_t *tx_data, size_t tx_data_bytes, uint8_t *resp,
-                                                size_t resp_bytes) {
-  // Wait for CTS
-  while (true) {
-    this->enable();
-    this->write_byte(SI446X_CMD_READ_CMD_BUFF);
-    const uint8_t cts = this->read_byte();
-    this->disable();
-    if (cts == 0xFF) {
-      break;
+void TemperBridgeComponent::dump_config() {
+  ESP_LOGCONFIG(TAG, "TemperBridge:");
+  LOG_PIN("  SDN Pin: ", this->sdn_pin_);
+  LOG_PIN("  Interrupt Pin: ", this->interrupt_pin_);
+  LOG_PIN("  CTS Pin: ", this->cts_pin_);
+  ESP_LOGCONFIG(TAG, "  Channel: %u", this->channel_.load());
+  ESP_LOGCONFIG(TAG, "  EZ frequency programming: %s", YESNO(this->ez_frequency_programming_));
+  ESP_LOGCONFIG(TAG, "  Massage coalesce window: %" PRIu32 " ms", this->massage_coalesce_window_);
+  ESP_LOGCONFIG(TAG, "  Receive: %s", YESNO(this->receive_));
+#ifdef USE_TEMPERBRIDGE_DEBUG_LOG
+  ESP_LOGCONFIG(TAG, "  Debug logging: YES");
+#endif
+#ifdef USE_TEMPERBRIDGE_TRACE
+  ESP_LOGCONFIG(TAG, "  SPI trace: %u entries", (unsigned) SPI_TRACE_ENTRIES);
+#endif
+  ESP_LOGCONFIG(TAG, "  Shadowed properties: %u", (unsigned) this->property_shadow_.size());
+  ESP_LOGCONFIG(TAG, "    Skipped writes: %" PRIu32, this->property_writes_skipped_.load());
+  ESP_LOGCONFIG(TAG, "    Verify: %s", YESNO(this->verify_properties_));
+#ifdef USE_TEMPERBRIDGE_RADIO_TASK
+  ESP_LOGCONFIG(TAG, "  Radio task: %s", YESNO(this->store_.task != nullptr));
+  ESP_LOGCONFIG(TAG, "    Dropped messages: %" PRIu32, this->radio_inbox_dropped_);
+#endif
+  if (this->lbt_) {
+    ESP_LOGCONFIG(TAG, "  Listen before talk threshold: %d dBm", si446x_rssi_to_dbm(this->lbt_threshold_));
+    ESP_LOGCONFIG(TAG, "    Deferrals: %" PRIu32, this->lbt_deferrals_.load());
+  }
+#ifdef USE_SENSOR
+  LOG_SENSOR("  ", "LBT Deferrals", this->lbt_deferrals_sensor_);
+#endif
+  ESP_LOGCONFIG(TAG, "  Head travel time: %" PRIu32 " ms", this->axes_[0].travel_time);
+  ESP_LOGCONFIG(TAG, "  Legs travel time: %" PRIu32 " ms", this->axes_[1].travel_time);
+#ifdef USE_SENSOR
+  LOG_SENSOR("  ", "Head Position", this->axes_[0].sensor);
+  LOG_SENSOR("  ", "Legs Position", this->axes_[1].sensor);
+  LOG_SENSOR("  ", "Action Latency", this->action_latency_sensor_);
+  LOG_SENSOR("  ", "Packet SPI Time", this->packet_spi_time_sensor_);
+  LOG_SENSOR("  ", "CTS Wait", this->cts_wait_sensor_);
+  LOG_SENSOR("  ", "PACKET_SENT Timeouts", this->packet_sent_timeouts_sensor_);
+  LOG_SENSOR("  ", "Queue Depth", this->queue_depth_sensor_);
+#endif
+  if (this->idle_sleep_time_ != 0) {
+    ESP_LOGCONFIG(TAG, "  Sleep after idle: %" PRIu32 " ms", this->idle_sleep_time_);
+    if (this->receive_) {
+      ESP_LOGCONFIG(TAG, "    RX sniff: %" PRIu32 " ms window every %" PRIu32 " ms", this->rx_sniff_window_,
+                    this->rx_sniff_interval_);
+    }
+  }
+#ifdef USE_SENSOR
+  LOG_SENSOR("  ", "Wake Latency", this->wake_latency_sensor_);
+#endif
+  ESP_LOGCONFIG(TAG, "  Learn dwell time: %" PRIu32 " ms", this->learn_dwell_time_);
+  ESP_LOGCONFIG(TAG, "  Learn timeout: %" PRIu32 " ms", this->learn_timeout_);
+  if (this->receive_) {
+    ESP_LOGCONFIG(TAG, "    Received packets: %" PRIu32, this->rx_received_);
+    ESP_LOGCONFIG(TAG, "    Invalid packets: %" PRIu32, this->rx_invalid_.load());
+    ESP_LOGCONFIG(TAG, "    Dropped packets: %" PRIu32, this->rx_dropped_.load());
+  }
+  ESP_LOGCONFIG(TAG, "  part %x", this->chip_info_.part);
+  ESP_LOGCONFIG(TAG, "  rev %x", this->chip_info_.chiprev);
+  // https://community.silabs.com/s/article/using-part-info-command-to-identify-ezradio-pro-part-number?language=en_US
+  ESP_LOGCONFIG(TAG, "  romid %x", this->chip_info_.romid);
+  ESP_LOGCONFIG(TAG, "  prbuild %x", this->chip_info_.prbuild);
+  if (this->radio_fault_) {
+    ESP_LOGE(TAG, "  Radio is not responding");
+    return;
+  }
+  ESP_LOGCONFIG(TAG, "  Radio bring-up took %" PRIu32 " us:", this->boot_timing_.total_us);
+  ESP_LOGCONFIG(TAG, "    Reset: %" PRIu32 " us", this->boot_timing_.reset_us);
+  ESP_LOGCONFIG(TAG, "    PART_INFO: %" PRIu32 " us", this->boot_timing_.part_info_us);
+  ESP_LOGCONFIG(TAG, "    Configuration: %" PRIu32 " us (%u commands)", this->boot_timing_.config_us,
+                this->boot_timing_.config_commands);
+  ESP_LOGCONFIG(TAG, "    Tune: %" PRIu32 " us", this->boot_timing_.tune_us);
+#ifdef USE_TEMPERBRIDGE_BENCHMARK
+  ESP_LOGCONFIG(TAG,
+                "  Benchmark: {\"crc_ns\":%" PRIu32 ",\"packet_build_ns\":%" PRIu32 ",\"freq_calc_ns\":%" PRIu32
+                ",\"config_parse_ns\":%" PRIu32 "}",
+                this->benchmark_.crc_ns, this->benchmark_.packet_build_ns, this->benchmark_.freq_calc_ns,
+                this->benchmark_.config_parse_ns);
+#endif
+}
+
+void TemperBridgeComponent::recover_radio_() {
+  const uint32_t now = millis();
+  if (now - this->last_recovery_attempt_ < RADIO_RECOVERY_INTERVAL_MS) {
+    return;
+  }
+  this->last_recovery_attempt_ = now;
+
+  ESP_LOGW(TAG, "Resetting radio");
+  // The packet that was in flight is lost, anything still queued goes out once the radio is back
+  if (this->tx_state_ != TxState::IDLE) {
+    this->complete_tx_(this->tx_current_.id, false);
+  }
+  this->tx_state_ = TxState::IDLE;
+
+  if (this->radio_init_()) {
+    ESP_LOGI(TAG, "Radio recovered");
+    this->status_clear_warning();
+  }
+}
+
+static void log_histogram(const char *name, const LatencyHistogram &histogram) {
+  ESP_LOGI(TAG, "  %s: count=%" PRIu32 " mean=%" PRIu32 "us p50<%" PRIu32 "us p95<%" PRIu32 "us p99<%" PRIu32
+                "us max=%" PRIu32 "us",
+           name, histogram.count(), histogram.mean(), histogram.percentile(0.5f), histogram.percentile(0.95f),
+           histogram.percentile(0.99f), histogram.max());
+  // Bucket i counts values below 2^i us
+  char buckets[LatencyHistogram::BUCKETS * 11 + 1];
+  size_t pos = 0;
+  for (size_t i = 0; i < LatencyHistogram::BUCKETS; i++) {
+    pos += snprintf(buckets + pos, sizeof(buckets) - pos, "%s%" PRIu32, i == 0 ? "" : ",", histogram.bucket(i));
+  }
+  ESP_LOGI(TAG, "    buckets: [%s]", buckets);
+}
+
+void TemperBridgeComponent::dump_metrics(bool reset) {
+  // Logged from a copy, the lock must not be held while anything else runs
+  RadioMetrics metrics;
+  {
+    LockGuard guard(this->radio_lock_);
+    metrics = this->metrics_;
+    if (reset) {
+      this->metrics_ = {};
     }
-    delay(20);
   }
 
-  this->enable();
-  this->write_array(tx_data, tx_data_bytes);
-  this->disable();
+  ESP_LOGI(TAG, "Radio metrics:");
+  log_histogram("Action to first packet", metrics.action_latency);
+  log_histogram("Packet SPI time", metrics.packet_spi);
+  log_histogram("Packet on air", metrics.packet_air);
+  log_histogram("CTS wait", metrics.cts_wait);
+  log_histogram("Wake to TX", metrics.wake_latency);
+  ESP_LOGI(TAG, "  Sleeps: %" PRIu32, metrics.sleeps);
+  ESP_LOGI(TAG, "  CTS polls: %" PRIu32, metrics.cts_polls);
+  ESP_LOGI(TAG, "  Packets sent: %" PRIu32, metrics.packets_sent);
+  ESP_LOGI(TAG, "  PACKET_SENT timeouts: %" PRIu32, metrics.packet_sent_timeouts);
+  ESP_LOGI(TAG, "  Channel changes: %" PRIu32, metrics.channel_changes);
+  ESP_LOGI(TAG, "  Interrupt clears: %" PRIu32 " (skipped %" PRIu32 ")", metrics.int_clears,
+           metrics.int_clears_skipped);
+  ESP_LOGI(TAG, "  Queue depth: %u (max %u)", metrics.queue_depth, metrics.queue_depth_max);
+  if (reset) {
+#ifdef USE_SENSOR
+    this->published_action_latency_ = {};
+    this->published_packet_spi_ = {};
+    this->published_cts_wait_ = {};
+    this->published_wake_latency_ = {};
+#endif
+  }
+}
 
-  // TODO timeout
-  if (resp) {
-    while (true) {
+// Entries per log line, each as 16 hex digits
+static const size_t SPI_TRACE_ENTRIES_PER_LINE = 8;
+
+void TemperBridgeComponent::dump_trace() {
+#ifdef USE_TEMPERBRIDGE_TRACE
+  // Logged from a copy like dump_metrics(), the radio task records under the same lock. Allocated before taking it,
+  // the ring is too big for the stack.
+  std::vector<SpiTraceEntry> entries(SPI_TRACE_ENTRIES);
+  uint32_t next;
+  {
+    LockGuard guard(this->radio_lock_);
+    next = this->trace_next_;
+    memcpy(entries.data(), this->trace_entries_.data(), sizeof(this->trace_entries_));
+  }
+  const uint32_t count = next < SPI_TRACE_ENTRIES ? next : SPI_TRACE_ENTRIES;
+  ESP_LOGI(TAG, "SPI trace: %" PRIu32 " entries, %" PRIu32 " recorded", count, next);
+
+  char line[SPI_TRACE_ENTRIES_PER_LINE * sizeof(SpiTraceEntry) * 2 + 1];
+  size_t pos = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    const SpiTraceEntry &entry = entries[(next - count + i) % SPI_TRACE_ENTRIES];
+    const auto *bytes = reinterpret_cast<const uint8_t *>(&entry);
+    for (size_t j = 0; j < sizeof(SpiTraceEntry); j++) {
+      pos += snprintf(line + pos, sizeof(line) - pos, "%02x", bytes[j]);
+    }
+    if ((i + 1) % SPI_TRACE_ENTRIES_PER_LINE == 0 || i + 1 == count) {
+      ESP_LOGI(TAG, "trace: %s", line);
+      pos = 0;
+    }
+  }
+#else
+  ESP_LOGW(TAG, "SPI tracing is not enabled, set trace: true");
+#endif
+}
+
+#ifdef USE_SENSOR
+// Latency sensors report the 95th percentile over the last interval, NAN when there was nothing to measure
+void TemperBridgeComponent::publish_metrics_() {
+  auto publish_p95 = [](sensor::Sensor *sensor, const LatencyHistogram &current, LatencyHistogram *published) {
+    if (sensor == nullptr) {
+      return;
+    }
+    const LatencyHistogram interval = current.since(*published);
+    *published = current;
+    sensor->publish_state(interval.count() == 0 ? NAN : interval.percentile(0.95f));
+  };
+  // Published from a copy, a sensor's automations may well dump the metrics
+  RadioMetrics metrics;
+  {
+    LockGuard guard(this->radio_lock_);
+    metrics = this->metrics_;
+    if (this->queue_depth_sensor_ != nullptr) {
+      this->metrics_.queue_depth_max = 0;
+    }
+  }
+
+  publish_p95(this->action_latency_sensor_, metrics.action_latency, &this->published_action_latency_);
+  publish_p95(this->packet_spi_time_sensor_, metrics.packet_spi, &this->published_packet_spi_);
+  publish_p95(this->cts_wait_sensor_, metrics.cts_wait, &this->published_cts_wait_);
+  publish_p95(this->wake_latency_sensor_, metrics.wake_latency, &this->published_wake_latency_);
+
+  if (this->packet_sent_timeouts_sensor_ != nullptr) {
+    this->packet_sent_timeouts_sensor_->publish_state(metrics.packet_sent_timeouts);
+  }
+  if (this->queue_depth_sensor_ != nullptr) {
+    this->queue_depth_sensor_->publish_state(metrics.queue_depth_max);
+  }
+}
+#endif
+
+void IRAM_ATTR TemperBridgeStore::gpio_intr(TemperBridgeStore *arg) {
+  arg->irq_pending = true;
+#ifdef USE_TEMPERBRIDGE_RADIO_TASK
+  if (arg->task != nullptr) {
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(arg->task, &higher_priority_task_woken);
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+  }
+#endif
+}
+
+// Polls for CTS, spinning first and then backing off in microsecond steps. With keep_selected the chip stays
+// selected after a successful READ_CMD_BUFF so the response can be clocked out in the same transaction.
+bool TemperBridgeComponent::si446x_wait_cts_(bool keep_selected) {
+  const uint32_t start = micros();
+  uint32_t backoff_us = 1;
+
+  while (true) {
+    this->metrics_.cts_polls++;
+    bool cts;
+    if (this->cts_pin_ != nullptr) {
+      cts = this->cts_pin_->digital_read();
+      if (cts && keep_selected) {
+        this->enable();
+        this->write_byte(SI446X_CMD_READ_CMD_BUFF);
+        this->read_byte();
+      }
+    } else {
       this->enable();
       this->write_byte(SI446X_CMD_READ_CMD_BUFF);
-      const uint8_t cts = this->read_byte();
-      if (cts != 0xFF) {
+      cts = this->read_byte() == 0xFF;
+      if (!cts || !keep_selected) {
         this->disable();
-        delay(20);
-        continue;
       }
+    }
 
-      this->read_array(resp, resp_bytes);
-      this->disable();
-      break;
+    const uint32_t elapsed = micros() - start;
+    if (cts) {
+      this->metrics_.cts_wait.record(elapsed);
+      return true;
+    }
+
+    if (elapsed > this->cts_timeout_us_) {
+      this->metrics_.cts_wait.record(elapsed);
+      return false;
+    }
+
+    if (elapsed < SI446X_CTS_SPIN_US) {
+      continue;
+    }
+
+    delayMicroseconds(backoff_us);
+    if (backoff_us < SI446X_CTS_MAX_BACKOFF_US) {
+      backoff_us *= 2;
+    }
+
+    if (elapsed > SI446X_CTS_YIELD_AFTER_US) {
+      yield();
     }
   }
 }
 
+// Sends the opcode followed by the args and data spans in one chip select, straight from the caller's buffers, then
+// reads the response into resp if there is one. Callers with a fixed header and a payload pass them as args and data
+// instead of copying them together first.
+bool TemperBridgeComponent::si446x_raw_command_(uint8_t command, const uint8_t *args, size_t arg_bytes,
+                                                const uint8_t *data, size_t data_bytes, uint8_t *resp,
+                                                size_t resp_bytes) {
+  // Don't pile more timeouts on top of a radio that is already known to be stuck
+  if (this->radio_fault_) {
+    return false;
+  }
+
+  const uint32_t start = micros();
+  const uint32_t cts_polls = this->metrics_.cts_polls;
+  const uint8_t flags = resp != nullptr ? SPI_TRACE_FLAG_RESPONSE : 0;
+  if (!this->si446x_wait_cts_(false)) {
+    this->trace_(start, command, arg_bytes + data_bytes, this->metrics_.cts_polls - cts_polls,
+                 flags | SPI_TRACE_FLAG_CTS_TIMEOUT);
+    this->si446x_cts_timeout_(command);
+    return false;
+  }
+
+  this->enable();
+  this->write_byte(command);
+  if (arg_bytes > 0) {
+    this->write_array(args, arg_bytes);
+  }
+  if (data_bytes > 0) {
+    this->write_array(data, data_bytes);
+  }
+  this->disable();
+
+  if (resp) {
+    if (!this->si446x_wait_cts_(true)) {
+      this->trace_(start, command, arg_bytes + data_bytes, this->metrics_.cts_polls - cts_polls,
+                   flags | SPI_TRACE_FLAG_CTS_TIMEOUT);
+      this->si446x_cts_timeout_(command);
+      return false;
+    }
+
+    this->read_array(resp, resp_bytes);
+    this->disable();
+  }
+
+  this->trace_(start, command, arg_bytes + data_bytes, this->metrics_.cts_polls - cts_polls, flags);
+  return true;
+}
+
+void TemperBridgeComponent::si446x_cts_timeout_(uint8_t command) {
+  ESP_LOGE(TAG, "Timed out waiting for CTS around command %02x", command);
+  this->radio_fault_ = true;
+  this->status_set_warning();
+}
+
 Si446xChipInfoResp TemperBridgeComponent::si446x_part_info_() {
   static_assert(sizeof(Si446xChipInfoResp) == 8, "size wrong");
   Si446xChipInfoResp ret;
@@ -100,27 +512,76 @@ Si446xChipInfoResp TemperBridgeComponent::si446x_part_info_() {
 
 void TemperBridgeComponent::si446x_execute_command_(uint8_t command, const uint8_t *args, size_t arg_bytes,
                                                     uint8_t *data, size_t data_bytes) {
-  uint8_t tx_data[arg_bytes + 1];
-  tx_data[0] = command;
-  if (arg_bytes > 0) {
-    assert(args != nullptr);
-    memcpy(tx_data + 1, args, arg_bytes);
-  }
-
-  this->si446x_raw_command_(tx_data, arg_bytes + 1, data, data_bytes);
+  assert(arg_bytes == 0 || args != nullptr);
+  this->si446x_raw_command_(command, args, arg_bytes, nullptr, 0, data, data_bytes);
 }
 
-void TemperBridgeComponent::si446x_configuration_init_(const uint8_t *data) {
+// Walks a WDS configuration array and hands every command to emit(command, size_bytes). With merge, runs of
+// consecutive properties in one group are re-packed into as few SET_PROPERTY commands as possible.
+template<typename F> static void si446x_walk_configuration(const uint8_t *data, bool merge, F &&emit) {
+  // SET_PROPERTY, group, num_props, start_prop, values...
+  uint8_t merged[4 + SI446X_MAX_SET_PROPERTY_PROPS] = {SI446X_CMD_SET_PROPERTY};
+  auto flush_merged = [&merged, &emit]() {
+    if (merged[2] == 0) {
+      return;
+    }
+    emit(merged, 4 + merged[2]);
+    merged[2] = 0;
+  };
+
   while (*data != 0) {
     const size_t size_bytes = *data++;
-    assert(size_bytes <= 16);
-
-    uint8_t command[size_bytes];
-    memcpy(command, data, size_bytes);
-    ESP_LOGI(TAG, "Processing command %x with # bytes: %d", command[0], size_bytes);
+    assert(size_bytes <= SI446X_MAX_COMMAND_BYTES);
+    const uint8_t *src = data;
     data += size_bytes;
-    si446x_raw_command_(command, size_bytes, nullptr, 0);
+
+    if (merge && src[0] == SI446X_CMD_SET_PROPERTY) {
+      const uint8_t group = src[1];
+      const uint8_t num_props = src[2];
+      const uint8_t start_prop = src[3];
+      for (uint8_t i = 0; i < num_props; i++) {
+        const uint8_t prop = start_prop + i;
+        if (merged[2] != 0 &&
+            (merged[1] != group || merged[3] + merged[2] != prop || merged[2] == SI446X_MAX_SET_PROPERTY_PROPS)) {
+          flush_merged();
+        }
+        if (merged[2] == 0) {
+          merged[1] = group;
+          merged[3] = prop;
+        }
+        merged[4 + merged[2]++] = src[4 + i];
+      }
+      continue;
+    }
+
+    flush_merged();
+    emit(src, size_bytes);
   }
+
+  flush_merged();
+}
+
+void TemperBridgeComponent::si446x_configuration_init_(const uint8_t *data) {
+  si446x_walk_configuration(data, this->merge_config_properties_, [this](const uint8_t *src, size_t size_bytes) {
+    TEMPERBRIDGE_LOG_HOT(TAG, "Processing command %x with # bytes: %u", src[0], (unsigned) size_bytes);
+    bool ok;
+    if (src[0] == SI446X_CMD_GPIO_PIN_CFG && this->cts_pin_ != nullptr) {
+      // The only command that gets patched, so the only one that needs a copy
+      uint8_t gpio_args[SI446X_MAX_COMMAND_BYTES - 1];
+      memcpy(gpio_args, src + 1, size_bytes - 1);
+      gpio_args[1] = SI446X_GPIO_MODE_CTS;  // GPIO1
+      ok = si446x_raw_command_(src[0], gpio_args, size_bytes - 1, nullptr, 0, nullptr, 0);
+    } else {
+      ok = si446x_raw_command_(src[0], src + 1, size_bytes - 1, nullptr, 0, nullptr, 0);
+    }
+    this->boot_timing_.config_commands++;
+    // Seeds the shadow with the configured properties
+    if (ok && src[0] == SI446X_CMD_SET_PROPERTY) {
+      for (uint8_t i = 0; i < src[2]; i++) {
+        this->property_shadow_.store(src[1], src[3] + i, src[4 + i]);
+      }
+    }
+  });
 }
 
 void TemperBridgeComponent::si446x_get_int_status(Si446xGetIntStatusResp *ret, bool clear_pending) {
@@ -139,16 +600,37 @@ void TemperBridgeComponent::si446x_get_int_status(Si446xGetIntStatusResp *ret, b
   }
 }
 
-void TemperBridgeComponent::read_irq_pend_frr() {
+// Reads FRR A-D in one burst. Fast response registers are answered straight away, without waiting for CTS, so
+// this is cheap enough for every interrupt and works even while a command is still running.
+Si446xIntPend TemperBridgeComponent::read_irq_pend_frr() {
+  static_assert(sizeof(Si446xIntPend) == 4, "wrong size");
+  Si446xIntPend ret;
+  this->trace_(micros(), SI446X_CMD_FRR_A_READ, 0, 0, SPI_TRACE_FLAG_RESPONSE);
   this->enable();
   this->write_byte(SI446X_CMD_FRR_A_READ);
-  const uint8_t a = this->read_byte();
-  const uint8_t b = this->read_byte();
-  const uint8_t c = this->read_byte();
-  const uint8_t d = this->read_byte();
-  ESP_LOGI(TAG, "a: %x, b: %x, c: %x, d: %x", a, b, c, d);
-
+  this->read_array((uint8_t *) &ret, sizeof(ret));
   this->disable();
+  TEMPERBRIDGE_LOG_HOT(TAG, "FRR int: %02x, ph: %02x, modem: %02x, chip: %02x", ret.int_pend, ret.ph_pend,
+                       ret.modem_pend, ret.chip_pend);
+  return ret;
+}
+
+// Clears just the given pending flags, anything that came in after they were read stays pending. Skips the
+// command altogether when there is nothing to clear.
+void TemperBridgeComponent::si446x_clear_int_pend_(uint8_t ph_pend, uint8_t modem_pend, uint8_t chip_pend) {
+  if (ph_pend == 0 && modem_pend == 0 && chip_pend == 0) {
+    this->metrics_.int_clears_skipped++;
+    return;
+  }
+
+  // A 0 bit clears the flag, a 1 leaves it alone. The response isn't needed.
+  const uint8_t args[] = {
+      static_cast<uint8_t>(~ph_pend),
+      static_cast<uint8_t>(~modem_pend),
+      static_cast<uint8_t>(~chip_pend),
+  };
+  si446x_execute_command_(SI446X_CMD_GET_INT_STATUS, args, sizeof(args), nullptr, 0);
+  this->metrics_.int_clears++;
 }
 
 enum class TemperCommand : uint32_t {
@@ -173,6 +655,12 @@ enum class TemperCommand : uint32_t {
 };
 
 #define TEMPER_CMD_BROADCAST_CH 0x96000000
+#define TEMPER_CMD_FAMILY_MASK 0xFF000000
+#define TEMPER_CMD_OPCODE_MASK 0xFFFF0000
+
+#define TEMPER_MASSAGE_MODE 0x968D0000
+// Every target starts at this level when a built-in massage mode is selected
+#define TEMPER_MASSAGE_PRESET_LEVEL 5
 
 // CRC table generated from http://www.sunshine2k.de/coding/javascript/crc/crc_js.html
 // The parameters were reversed using http://reveng.sourceforge.net/
@@ -205,45 +693,207 @@ uint8_t temper_crc(const uint8_t data[], size_t len) {
   return ret;
 }
 
-void TemperBridgeComponent::start_positioning(PositionCommand cmd) {
-  TemperCommand command;
+static TemperCommand temper_position_command(PositionCommand cmd) {
   switch (cmd) {
     case PositionCommand::LOWER_HEAD:
-      command = TemperCommand::HEAD_DOWN;
-      break;
+      return TemperCommand::HEAD_DOWN;
     case PositionCommand::LOWER_LEGS:
-      command = TemperCommand::LEG_DOWN;
-      break;
+      return TemperCommand::LEG_DOWN;
     case PositionCommand::RAISE_HEAD:
-      command = TemperCommand::HEAD_UP;
-      break;
+      return TemperCommand::HEAD_UP;
     case PositionCommand::RAISE_LEGS:
-      command = TemperCommand::LEG_UP;
-      break;
+    default:
+      return TemperCommand::LEG_UP;
+  }
+}
+
+static PositionAxis temper_position_axis(PositionCommand cmd) {
+  return cmd == PositionCommand::RAISE_HEAD || cmd == PositionCommand::LOWER_HEAD ? PositionAxis::HEAD
+                                                                                   : PositionAxis::LEGS;
+}
+
+static int8_t temper_position_direction(PositionCommand cmd) {
+  return cmd == PositionCommand::RAISE_HEAD || cmd == PositionCommand::RAISE_LEGS ? 1 : -1;
+}
+
+static const uint8_t TEMPER_POSITION_NUDGE_REPEATS = 5;
+
+uint32_t TemperBridgeComponent::start_positioning(PositionCommand cmd) {
+  const uint32_t id =
+      this->queue_command_(static_cast<uint32_t>(temper_position_command(cmd)), TEMPER_POSITION_NUDGE_REPEATS);
+  // There's no STOP, the base stops by itself once the packets end
+  this->track_motion_(cmd, id, id, TEMPER_POSITION_NUDGE_REPEATS * TEMPER_INTER_PACKET_GAP_US / 1000, NAN);
+  return id;
+}
+
+// Drives past the end stop by this much of the travel time so an axis of unknown position is sure to reach it
+static const float TEMPER_POSITION_OVERDRIVE = 1.1f;
+// Moves shorter than this aren't worth a packet
+static const float TEMPER_POSITION_TOLERANCE = 0.01f;
+
+// Streams the motion command for duration_ms and then sends STOP. Returns the id of the STOP, which completes when the
+// base has stopped.
+uint32_t TemperBridgeComponent::move_for(PositionCommand cmd, uint32_t duration_ms) {
+  return this->drive_(cmd, duration_ms, NAN, 0);
+}
+
+uint32_t TemperBridgeComponent::drive_(PositionCommand cmd, uint32_t duration_ms, float end_stop, uint32_t stop_id) {
+  // The base keeps moving until the STOP arrives, one inter-packet gap after the last motion packet
+  const uint32_t gap_ms = TEMPER_INTER_PACKET_GAP_US / 1000;
+  const uint32_t hold_ms = duration_ms > gap_ms ? duration_ms - gap_ms : 0;
+  const uint32_t motion_id =
+      this->queue_command_(static_cast<uint32_t>(temper_position_command(cmd)), 1, TxPriority::NORMAL, 0, 0, hold_ms);
+  // The base ends massage on any STOP, this one included
+  this->stop_massage_();
+  stop_id = this->queue_command_(static_cast<uint32_t>(TemperCommand::STOP), 3, TxPriority::NORMAL, 0, stop_id);
+  this->track_motion_(cmd, motion_id, stop_id, duration_ms, end_stop);
+  return stop_id;
+}
+
+// Moves the axis to position (0 flat, 1 fully raised) based on its travel time. An axis whose position isn't known
+// yet is first driven down to its end stop.
+uint32_t TemperBridgeComponent::move_to_position(PositionAxis axis, float position) {
+  AxisPosition &state = this->axes_[static_cast<uint8_t>(axis)];
+  position = clamp(position, 0.0f, 1.0f);
+  const PositionCommand raise = axis == PositionAxis::HEAD ? PositionCommand::RAISE_HEAD : PositionCommand::RAISE_LEGS;
+  const PositionCommand lower = axis == PositionAxis::HEAD ? PositionCommand::LOWER_HEAD : PositionCommand::LOWER_LEGS;
+  const uint32_t full_travel = state.travel_time * TEMPER_POSITION_OVERDRIVE;
+
+  if (position == 0.0f || position == 1.0f) {
+    // Ends are exact no matter where the axis started
+    return this->drive_(position == 0.0f ? lower : raise, full_travel, position, 0);
+  }
+
+  float from = state.planned;
+  if (std::isnan(from)) {
+    this->drive_(lower, full_travel, 0.0f, 0);
+    from = 0.0f;
+  }
+
+  const float delta = position - from;
+  if (std::fabs(delta) < TEMPER_POSITION_TOLERANCE) {
+    return 0;
+  }
+  return this->drive_(delta > 0 ? raise : lower, std::fabs(delta) * state.travel_time, NAN, 0);
+}
+
+// Follows a queued move so the position estimate can be updated from when it actually started and stopped on air.
+// end_stop is the end (0 or 1) the move is long enough to reach from anywhere, NAN if it isn't.
+void TemperBridgeComponent::track_motion_(PositionCommand cmd, uint32_t motion_id, uint32_t end_id,
+                                          uint32_t duration_ms, float end_stop) {
+  AxisPosition &state = this->axes_[static_cast<uint8_t>(temper_position_axis(cmd))];
+  const int8_t direction = temper_position_direction(cmd);
+  const AxisSegment segment = {.motion_id = motion_id,
+                               .end_id = end_id,
+                               .direction = direction,
+                               .end_stop = end_stop,
+                               .start = 0,
+                               .started = false};
+  if (!state.segments.push(segment)) {
+    // Too many moves in flight to follow
+    ESP_LOGW(TAG, "Lost track of the position");
+    state.segments.clear();
+    state.position = NAN;
+    state.planned = NAN;
+    return;
+  }
+
+  // Where the axis should end up once everything queued has gone out
+  if (!std::isnan(end_stop)) {
+    state.planned = end_stop;
+  } else {
+    state.planned = clamp(state.planned + direction * (float) duration_ms / state.travel_time, 0.0f, 1.0f);
+  }
+}
+
+void TemperBridgeComponent::position_tx_event_(const TxEvent &event) {
+  for (uint8_t i = 0; i < this->axes_.size(); i++) {
+    AxisPosition &state = this->axes_[i];
+    if (state.segments.empty()) {
+      continue;
+    }
+    AxisSegment &segment = state.segments[0];
+
+    // A move with a STOP ends when the STOP starts going out, a fixed burst when its last packet is sent. Either ends
+    // early when dropped.
+    const bool ends = event.id == segment.end_id &&
+                      (event.type == TxEventType::DROPPED ||
+                       event.type == (segment.end_id == segment.motion_id ? TxEventType::SENT : TxEventType::STARTED));
+    if (ends) {
+      if (segment.started) {
+        const uint32_t elapsed = millis() - segment.start;
+        if (!std::isnan(segment.end_stop) && elapsed >= state.travel_time) {
+          state.position = segment.end_stop;
+        } else {
+          state.position =
+              clamp(state.position + segment.direction * (float) elapsed / state.travel_time, 0.0f, 1.0f);
+        }
+      }
+      state.segments.pop();
+      if (state.segments.empty()) {
+        // Anything that was dropped on the way didn't move the axis
+        state.planned = state.position;
+      }
+#ifdef USE_SENSOR
+      if (state.sensor != nullptr && !std::isnan(state.position)) {
+        state.sensor->publish_state(state.position * 100.0f);
+      }
+#endif
+    } else if (event.id == segment.motion_id && event.type == TxEventType::STARTED) {
+      segment.started = true;
+      segment.start = millis();
+    } else if (event.id == segment.motion_id && event.type == TxEventType::DROPPED) {
+      // Never went on air, its STOP on its own doesn't move anything
+      state.segments.pop();
+      if (state.segments.empty()) {
+        state.planned = state.position;
+      }
+    }
   }
+}
 
-  for (int i = 0; i < 5; i++) {
-    this->transmit_command_(static_cast<uint32_t>(command));
+// Current estimate, including how far a move in progress has come. NAN until the axis went to an end stop.
+float TemperBridgeComponent::get_position(PositionAxis axis) const {
+  const AxisPosition &state = this->axes_[static_cast<uint8_t>(axis)];
+  if (state.segments.empty() || !state.segments.front().started) {
+    return state.position;
   }
+  const AxisSegment &segment = state.segments.front();
+  return clamp(state.position + segment.direction * (float) (millis() - segment.start) / state.travel_time, 0.0f,
+               1.0f);
 }
 
-void TemperBridgeComponent::execute_simple_command(SimpleCommand cmd) {
+// The presets move both axes to wherever they were saved. FLAT is known, the memory positions aren't.
+void TemperBridgeComponent::reset_positions_(float position) {
+  for (AxisPosition &state : this->axes_) {
+    state.segments.clear();
+    state.position = position;
+    state.planned = position;
+  }
+}
+
+uint32_t TemperBridgeComponent::execute_simple_command(SimpleCommand cmd) {
   TemperCommand command;
   switch (cmd) {
     case SimpleCommand::PRESET_FLAT:
       command = TemperCommand::FLAT;
+      this->reset_positions_(0.0f);
       break;
     case SimpleCommand::PRESET_MODE1:
       command = TemperCommand::MEM_1;
+      this->reset_positions_(NAN);
       break;
     case SimpleCommand::PRESET_MODE2:
       command = TemperCommand::MEM_2;
+      this->reset_positions_(NAN);
       break;
     case SimpleCommand::PRESET_MODE3:
       command = TemperCommand::MEM_3;
+      this->reset_positions_(NAN);
       break;
     case SimpleCommand::PRESET_MODE4:
       command = TemperCommand::MEM_4;
+      this->reset_positions_(NAN);
       break;
     case SimpleCommand::SAVE_PRESET_MODE1:
       command = TemperCommand::SET_MEM_1;
@@ -259,10 +909,7 @@ void TemperBridgeComponent::execute_simple_command(SimpleCommand cmd) {
       break;
     case SimpleCommand::STOP:
       command = TemperCommand::STOP;
-      this->massage_head_intensity_ = 0;
-      this->massage_leg_intensity_ = 0;
-      this->massage_lumbar_intensity_ = 0;
-      this->massage_command_mode_ = MassageCommandMode::CUSTOM;
+      this->stop_massage_();
       break;
     case SimpleCommand::MASSAGE_PRESET_MODE1:
       command = TemperCommand::MASSAGE_MODE_1;
@@ -276,74 +923,628 @@ void TemperBridgeComponent::execute_simple_command(SimpleCommand cmd) {
     case SimpleCommand::MASSAGE_PRESET_MODE4:
       command = TemperCommand::MASSAGE_MODE_4;
       break;
+    default:
+      ESP_LOGE(TAG, "Unknown simple command %d", static_cast<int>(cmd));
+      return 0;
   }
 
   if (cmd == SimpleCommand::MASSAGE_PRESET_MODE1 || cmd == SimpleCommand::MASSAGE_PRESET_MODE2 ||
       cmd == SimpleCommand::MASSAGE_PRESET_MODE3 || cmd == SimpleCommand::MASSAGE_PRESET_MODE4) {
-    this->massage_head_intensity_ = 5;
-    this->massage_leg_intensity_ = 5;
-    this->massage_lumbar_intensity_ = 5;
-    this->massage_command_mode_ = MassageCommandMode::BUILTIN;
+    this->set_massage_state_(TEMPER_MASSAGE_PRESET_LEVEL, MassageCommandMode::BUILTIN);
   }
 
-  for (int i = 0; i < 3; i++) {
-    this->transmit_command_(static_cast<uint32_t>(command));
-  }
+  const TxPriority priority = cmd == SimpleCommand::STOP ? TxPriority::HIGH : TxPriority::NORMAL;
+  return this->queue_command_(static_cast<uint32_t>(command), 3, priority);
 }
 
-void TemperBridgeComponent::transmit_command_(uint32_t command) {
-  const uint32_t tx_start = micros();
-
-  // This command doesn't need to wait for CTS
-  uint8_t packet_bytes[9] = {0};
+// Builds the complete WRITE_TX_FIFO transaction for one packet: command, length byte, packet
+static void temper_build_packet(uint32_t command, uint16_t channel, uint8_t *packet_bytes) {
   static_assert(sizeof(TemperPacket) == 7, "wrong size");
   packet_bytes[0] = SI446X_CMD_WRITE_TX_FIFO;
   packet_bytes[1] = sizeof(TemperPacket);
 
-  TemperPacket packet = {.cmd = convert_big_endian(command), .channel = convert_big_endian(this->channel_)};
+  TemperPacket packet = {.cmd = convert_big_endian(command), .channel = convert_big_endian(channel)};
   packet.crc = temper_crc((uint8_t *) &packet, 6);
   memcpy(packet_bytes + 2, &packet, sizeof(TemperPacket));
+}
+
+void TemperBridgeComponent::transmit_command_(uint32_t command, uint16_t channel) {
+  // This command doesn't need to wait for CTS
+  uint8_t packet_bytes[TEMPER_TX_FIFO_WRITE_BYTES];
+  temper_build_packet(command, channel, packet_bytes);
+  this->rx_active_ = false;
 
+  this->trace_(micros(), SI446X_CMD_WRITE_TX_FIFO, sizeof(packet_bytes) - 1, 0, 0);
   this->enable();
   this->write_array(packet_bytes, sizeof(packet_bytes));
   this->disable();
 
-  this->si446x_start_tx_();
+  this->si446x_start_tx_(this->select_channel_(channel), false);
+}
 
-  const uint32_t start_time = millis();
-  while (this->interrupt_pin_->digital_read()) {
-    if (millis() - start_time > 50) {
-      break;
+// Sends the packet still sitting in the TX FIFO again, without rebuilding or reloading it
+void TemperBridgeComponent::retransmit_command_(uint16_t channel) {
+  this->rx_active_ = false;
+  this->si446x_start_tx_(this->select_channel_(channel), true);
+}
+
+// A HIGH priority command preempts everything else: queued commands are dropped so none of them can undo it, a
+// command that is on air loses its remaining repeats, and a packet still listening before talk is abandoned. It
+// therefore goes out in the very next slot, at most one inter-packet gap after it was queued.
+// A command with a non-zero coalesce_key replaces a queued command with the same key that hasn't started yet.
+// Returns the id that the TX complete callbacks report once the request has left the radio or was dropped.
+// With a non-zero hold_ms the command keeps repeating until hold_ms have passed since its first packet.
+uint32_t TemperBridgeComponent::queue_command_(uint32_t command, uint8_t repeats, TxPriority priority,
+                                               uint8_t coalesce_key, uint32_t id, uint32_t hold_ms) {
+  if (id == 0) {
+    id = this->allocate_tx_id_();
+  }
+  this->dispatch_({.type = RadioMessageType::QUEUE_COMMAND,
+                   .priority = priority,
+                   .repeats = repeats,
+                   .coalesce_key = coalesce_key,
+                   .channel = 0,
+                   .command = command,
+                   .id = id,
+                   .hold_ms = hold_ms,
+                   .queued_at = micros()});
+  return id;
+}
+
+uint32_t TemperBridgeComponent::allocate_tx_id_() {
+  // 0 means "nothing was queued"
+  if (++this->next_tx_id_ == 0) {
+    this->next_tx_id_ = 1;
+  }
+  return this->next_tx_id_;
+}
+
+// Called wherever the radio is serviced. The callbacks run later on the main loop.
+void TemperBridgeComponent::complete_tx_(uint32_t id, bool sent) {
+  if (!this->tx_events_.push({.id = id, .type = sent ? TxEventType::SENT : TxEventType::DROPPED})) {
+    ESP_LOGW(TAG, "TX completion for request %" PRIu32 " lost", id);
+  }
+}
+
+void TemperBridgeComponent::enqueue_tx_(const RadioMessage &message) {
+  const uint32_t command = message.command;
+  const TxPriority priority = message.priority;
+  const uint8_t coalesce_key = message.coalesce_key;
+  const TxRequest request = {.command = command,
+                             .channel = this->channel_,
+                             .repeats = message.repeats,
+                             .priority = priority,
+                             .coalesce_key = coalesce_key,
+                             .id = message.id,
+                             .hold_ms = message.hold_ms,
+                             .queued_at = message.queued_at};
+
+  if (coalesce_key != 0 && priority == TxPriority::NORMAL) {
+    for (size_t i = 0; i < this->tx_queue_normal_.size(); i++) {
+      if (this->tx_queue_normal_[i].coalesce_key == coalesce_key) {
+        this->complete_tx_(this->tx_queue_normal_[i].id, false);
+        this->tx_queue_normal_[i] = request;
+        return;
+      }
     }
   }
 
-  Si446xGetIntStatusResp int_status;
-  si446x_get_int_status(&int_status, true);
-  //int_status.print();
+  const uint8_t depth = this->tx_queue_high_.size() + this->tx_queue_normal_.size();
+  this->metrics_.queue_depth = depth;
+  if (depth > this->metrics_.queue_depth_max) {
+    this->metrics_.queue_depth_max = depth;
+  }
+
+  bool queued;
+  if (priority == TxPriority::HIGH) {
+    for (size_t i = 0; i < this->tx_queue_normal_.size(); i++) {
+      this->complete_tx_(this->tx_queue_normal_[i].id, false);
+    }
+    this->tx_queue_normal_.clear();
+    if (this->tx_state_ == TxState::CLEAR_CHANNEL_ASSESSMENT && this->tx_current_.priority != TxPriority::HIGH) {
+      // The packet is still waiting for a clear channel and could sit out several backoffs. Abandon it so this
+      // command goes next. A request that already had packets on air is done, like in WAIT_GAP below.
+      this->complete_tx_(this->tx_current_.id, this->tx_retransmit_);
+      this->tx_state_ = TxState::IDLE;
+    } else if (this->tx_state_ != TxState::IDLE && this->tx_current_.priority != TxPriority::HIGH) {
+      this->tx_current_.repeats = 1;
+      this->tx_current_.hold_ms = 0;
+      // The packet that was just sent turned out to be the last one
+      if (this->tx_state_ == TxState::WAIT_GAP && !this->tx_last_packet_) {
+        this->tx_last_packet_ = true;
+        this->complete_tx_(this->tx_current_.id, true);
+      }
+    }
+    queued = this->tx_queue_high_.push(request);
+  } else {
+    queued = this->tx_queue_normal_.push(request);
+  }
+
+  if (!queued) {
+    ESP_LOGW(TAG, "TX queue full, dropping command %08" PRIx32, command);
+    this->complete_tx_(request.id, false);
+    return;
+  }
+
+  if (!this->radio_on_task_()) {
+    this->high_freq_.start();
+  }
+}
 
-  uint32_t tx_diff = micros() - tx_start;
-  ESP_LOGI(TAG, "took %u us to TX one packet", tx_diff);
+// Puts the next packet of the current request on air. With listen-before-talk the radio first listens on the channel,
+// except for HIGH priority requests whose latency must stay bounded.
+void TemperBridgeComponent::begin_packet_(bool retransmit) {
+  this->tx_retransmit_ = retransmit;
+  this->tx_deferrals_ = 0;
 
-  while (tx_diff < 100000) {
-    delay(10);
-    tx_diff = micros() - tx_start;
+  if (!this->lbt_ || this->tx_current_.priority == TxPriority::HIGH) {
+    this->send_packet_();
+    return;
   }
 
-  ESP_LOGI(TAG, "after delay: took %u us to TX one packet", tx_diff);
+  this->start_rx_(this->tx_current_.channel);
+  this->cca_start_ = micros();
+  this->cca_wait_us_ = TEMPER_LBT_RSSI_SETTLE_US;
+  this->tx_state_ = TxState::CLEAR_CHANNEL_ASSESSMENT;
+}
+
+void TemperBridgeComponent::send_packet_() {
+  this->tx_start_ = micros();
+  this->packet_sent_ = false;
+  if (this->tx_retransmit_) {
+    this->retransmit_command_(this->tx_current_.channel);
+  } else {
+    this->metrics_.action_latency.record(this->tx_start_ - this->tx_current_.queued_at);
+    this->transmit_command_(this->tx_current_.command, this->tx_current_.channel);
+  }
+  this->metrics_.packet_spi.record(micros() - this->tx_start_);
+  if (this->wake_pending_tx_) {
+    this->wake_pending_tx_ = false;
+    this->metrics_.wake_latency.record(micros() - this->wake_start_);
+  }
+  this->tx_state_ = TxState::WAIT_PACKET_SENT;
+}
+
+// Advances the TX state machine by at most one step. Every packet goes through
+// load FIFO + START_TX -> wait for PACKET_SENT -> hold the inter-packet gap, and
+// control goes back to the main loop between each of those steps.
+void TemperBridgeComponent::service_tx_() {
+  switch (this->tx_state_) {
+    case TxState::IDLE: {
+      if (!this->tx_queue_high_.empty()) {
+        this->tx_current_ = this->tx_queue_high_.pop();
+      } else if (!this->tx_queue_normal_.empty()) {
+        this->tx_current_ = this->tx_queue_normal_.pop();
+      } else {
+        if (!this->radio_on_task_()) {
+          this->high_freq_.stop();
+        }
+        // Listen whenever there's nothing to send
+        if ((this->receive_ || this->learning_) && !this->rx_active_) {
+          this->start_rx_(this->listen_channel_());
+        }
+        return;
+      }
+
+      this->tx_hold_start_ = millis();
+      this->tx_events_.push({.id = this->tx_current_.id, .type = TxEventType::STARTED});
+      this->begin_packet_(false);
+      break;
+    }
+    case TxState::CLEAR_CHANNEL_ASSESSMENT: {
+      if (micros() - this->cca_start_ < this->cca_wait_us_) {
+        return;
+      }
+
+      Si446xModemStatusResp modem_status;
+      this->si446x_get_modem_status_(&modem_status);
+      if (modem_status.curr_rssi <= this->lbt_threshold_ || this->tx_deferrals_ >= TEMPER_LBT_MAX_DEFERRALS) {
+        this->send_packet_();
+        return;
+      }
+
+      // Somebody else is on air, most likely the remote. Back off for a random time so we don't keep colliding.
+      this->tx_deferrals_++;
+      this->lbt_deferrals_++;
+      this->cca_start_ = micros();
+      this->cca_wait_us_ =
+          TEMPER_LBT_MIN_BACKOFF_US + random_uint32() % (TEMPER_LBT_MAX_BACKOFF_US - TEMPER_LBT_MIN_BACKOFF_US);
+      break;
+    }
+    case TxState::WAIT_PACKET_SENT: {
+      if (!this->packet_sent_) {
+        if (micros() - this->tx_start_ < TEMPER_PACKET_SENT_TIMEOUT_US) {
+          return;
+        }
+
+        // The nIRQ edge may have been missed, the FRR tells without a CTS round trip
+        this->handle_int_pend_(this->read_irq_pend_frr());
+      }
+      if (!this->packet_sent_) {
+        ESP_LOGW(TAG, "Timed out waiting for PACKET_SENT");
+        this->metrics_.packet_sent_timeouts++;
+      }
+
+      this->metrics_.packets_sent++;
+      this->metrics_.packet_air.record(micros() - this->tx_start_);
+      TEMPERBRIDGE_LOG_HOT(TAG, "took %u us to TX one packet", (unsigned) (micros() - this->tx_start_));
+      // A held command goes on until the next packet would start after the hold time
+      this->tx_last_packet_ =
+          this->tx_current_.repeats == 1 &&
+          millis() + TEMPER_INTER_PACKET_GAP_US / 1000 - this->tx_hold_start_ >= this->tx_current_.hold_ms;
+      if (this->tx_last_packet_) {
+        this->complete_tx_(this->tx_current_.id, true);
+      }
+      this->tx_state_ = TxState::WAIT_GAP;
+      break;
+    }
+    case TxState::WAIT_GAP: {
+      const uint32_t tx_diff = micros() - this->tx_start_;
+      if (tx_diff < TEMPER_INTER_PACKET_GAP_US) {
+        return;
+      }
+
+      TEMPERBRIDGE_LOG_HOT(TAG, "after delay: took %u us to TX one packet", (unsigned) tx_diff);
+
+      if (!this->tx_last_packet_) {
+        if (this->tx_current_.repeats > 1) {
+          this->tx_current_.repeats--;
+        }
+        this->begin_packet_(true);
+      } else {
+        this->tx_state_ = TxState::IDLE;
+      }
+      break;
+    }
+  }
 }
 
 void TemperBridgeComponent::loop() {
-  if (!this->interrupt_pin_->digital_read()) {
-    Si446xGetIntStatusResp int_status;
-    si446x_get_int_status(&int_status, true);
-    int_status.print();
+  if (!this->initialized_) {
+    return;
+  }
+
+  if (!this->radio_on_task_()) {
+    this->service_radio_();
   }
+
+  this->process_rx_packets_();
+
+  uint16_t channel;
+  while (this->channels_learned_.pop(&channel)) {
+    this->channel_learned_callback_.call(channel);
+  }
+
+  TxEvent event;
+  while (this->tx_events_.pop(&event)) {
+    this->handle_tx_event_(event);
+  }
+
+#ifdef USE_SENSOR
+  const uint32_t lbt_deferrals = this->lbt_deferrals_;
+  if (this->lbt_deferrals_sensor_ != nullptr && lbt_deferrals != this->lbt_deferrals_published_) {
+    this->lbt_deferrals_published_ = lbt_deferrals;
+    this->lbt_deferrals_sensor_->publish_state(lbt_deferrals);
+  }
+#endif
 }
 
-void TemperBridgeComponent::set_channel(uint16_t channel) {
+// Runs on the main loop, never from inside the call that queued the request
+void TemperBridgeComponent::handle_tx_event_(const TxEvent &event) {
+  this->position_tx_event_(event);
+  if (event.type != TxEventType::STARTED) {
+    this->tx_complete_callback_.call(event.id, event.type == TxEventType::SENT);
+  }
+}
+
+// One pass over everything that talks to the radio, from loop() or from the radio task
+void TemperBridgeComponent::service_radio_() {
+#ifdef USE_TEMPERBRIDGE_RADIO_TASK
+  RadioMessage message;
+  while (this->radio_inbox_.pop(&message)) {
+    this->handle_radio_message_(message);
+  }
+#endif
+
+  if (this->radio_fault_) {
+    this->recover_radio_();
+    return;
+  }
+
+  this->service_irq_();
+  this->service_tx_();
+  if (this->learning_) {
+    this->service_learning_();
+  }
+  this->service_power_();
+}
+
+void TemperBridgeComponent::dispatch_(const RadioMessage &message) {
+#ifdef USE_TEMPERBRIDGE_RADIO_TASK
+  if (this->store_.task != nullptr) {
+    if (!this->radio_inbox_.push(message)) {
+      this->radio_inbox_dropped_++;
+      ESP_LOGW(TAG, "Radio task inbox full, dropping message");
+      // The caller hasn't seen the request id yet, so the drop is reported from the next loop() like any other
+      // completion. tx_events_ belongs to the radio task and can't be pushed from here.
+      if (message.type == RadioMessageType::QUEUE_COMMAND) {
+        const TxEvent event = {.id = message.id, .type = TxEventType::DROPPED};
+        this->defer([this, event]() { this->handle_tx_event_(event); });
+      }
+      return;
+    }
+    xTaskNotifyGive(this->store_.task);
+    return;
+  }
+#endif
+  this->handle_radio_message_(message);
+}
+
+void TemperBridgeComponent::handle_radio_message_(const RadioMessage &message) {
+  // Every message ends up talking to the radio
+  if (this->wake_radio_() && message.type == RadioMessageType::QUEUE_COMMAND) {
+    this->wake_pending_tx_ = true;
+  }
+
+  switch (message.type) {
+    case RadioMessageType::QUEUE_COMMAND:
+      this->enqueue_tx_(message);
+      break;
+    case RadioMessageType::SET_CHANNEL:
+      this->apply_channel_(message.channel);
+      break;
+    case RadioMessageType::START_LEARNING:
+      this->begin_learning_();
+      break;
+    case RadioMessageType::FINISH_LEARNING:
+      this->complete_learning_(message.channel);
+      break;
+  }
+}
+
+#ifdef USE_TEMPERBRIDGE_RADIO_TASK
+// Owns the radio from setup() on. Waits for the nIRQ interrupt or a new message while the radio is idle and polls
+// every tick while a packet is being sent, LBT is listening or the channel is being learned.
+// SPI transactions aren't serialized against other devices on the loop task, so the bus must not be shared.
+void TemperBridgeComponent::radio_task_(void *arg) {
+  auto *parent = static_cast<TemperBridgeComponent *>(arg);
+  while (true) {
+    {
+      LockGuard guard(parent->radio_lock_);
+      parent->service_radio_();
+    }
+    const bool busy = parent->tx_state_ != TxState::IDLE || parent->learning_ || parent->radio_fault_;
+    TickType_t wait = busy ? 1 : portMAX_DELAY;
+    // Wake up in time to put the radio to sleep
+    if (!busy && parent->idle_sleep_time_ != 0 && !parent->asleep_) {
+      const uint32_t idle = millis() - parent->idle_start_;
+      wait = idle >= parent->idle_sleep_time_ ? 1 : pdMS_TO_TICKS(parent->idle_sleep_time_ - idle) + 1;
+    }
+    ulTaskNotifyTake(pdTRUE, wait);
+  }
+}
+#endif
+
+// Only talks to the radio when the nIRQ ISR has latched an event
+void TemperBridgeComponent::service_irq_() {
+  if (!this->store_.irq_pending) {
+    return;
+  }
+  this->store_.irq_pending = false;
+
+  this->handle_int_pend_(this->read_irq_pend_frr());
+  // Talking to the chip woke it, and a sniffed packet left it in READY
+  if (this->asleep_) {
+    this->si446x_change_state_(SI446X_STATE_SLEEP);
+  }
+
+  // Another event may have come in before the clear, in which case nIRQ is still low and no new edge will arrive
+  if (!this->store_.pin.digital_read()) {
+    this->store_.irq_pending = true;
+  }
+}
+
+// Only the packet handler group drives nIRQ (INT_CTL_ENABLE), so its flags are the only ones that have to be
+// cleared. Modem flags are left latched, chip flags are only cleared when they report an error.
+void TemperBridgeComponent::handle_int_pend_(Si446xIntPend pend) {
+  if (pend.ph_pend & SI446X_PH_PACKET_SENT_PEND) {
+    this->packet_sent_ = true;
+  }
+
+  const uint8_t chip_errors = pend.chip_pend & (SI446X_CHIP_CMD_ERROR_PEND | SI446X_CHIP_FIFO_ERROR_PEND);
+  if ((pend.ph_pend & ~(SI446X_PH_PACKET_SENT_PEND | SI446X_PH_PACKET_RX_PEND)) || chip_errors) {
+    pend.print();
+  }
+
+  // Cleared before draining the FIFO so a packet arriving during the read raises a new edge
+  this->si446x_clear_int_pend_(pend.ph_pend, 0, chip_errors);
+
+  if (pend.ph_pend & SI446X_PH_PACKET_RX_PEND) {
+    this->read_rx_packet_();
+  }
+}
+
+// Nothing queued, on air or being learned
+bool TemperBridgeComponent::radio_idle_() const {
+  return this->tx_state_ == TxState::IDLE && this->tx_queue_high_.empty() && this->tx_queue_normal_.empty() &&
+         !this->learning_;
+}
+
+void TemperBridgeComponent::service_power_() {
+  if (this->idle_sleep_time_ == 0 || this->asleep_ || this->radio_fault_) {
+    return;
+  }
+
+  const uint32_t now = millis();
+  if (!this->radio_idle_()) {
+    this->idle_start_ = now;
+    return;
+  }
+  if (now - this->idle_start_ >= this->idle_sleep_time_) {
+    this->enter_sleep_();
+  }
+}
+
+// Without receive the 32 kHz oscillator stays off and the chip goes to STANDBY, the lowest state that keeps its
+// configuration. With receive the wake-up timer runs it in low duty cycle mode instead: every sniff interval it
+// opens an RX window, and goes back to SLEEP unless a packet starts in it.
+void TemperBridgeComponent::enter_sleep_() {
+  if (this->receive_) {
+    Si446xSetPropertyArgs clk_args = {
+        .group = SI446X_PROP_GROUP_GLOBAL,
+        .num_props = 1,
+        .start_prop = SI446X_PROP_GLOBAL_CLK_CFG,
+    };
+    uint8_t clk_cfg = SI446X_CLK_32K_SEL_RC;
+    si446x_set_property_(&clk_args, &clk_cfg);
+
+    // WUT_CONFIG, WUT_M 15:8, WUT_M 7:0, WUT_R, WUT_LDC
+    const Si446xWutConfig wut = si446x_wut_config(this->rx_sniff_interval_, this->rx_sniff_window_);
+    Si446xSetPropertyArgs wut_args = {
+        .group = SI446X_PROP_GROUP_GLOBAL,
+        .num_props = 5,
+        .start_prop = SI446X_PROP_GLOBAL_WUT_CONFIG,
+    };
+    uint8_t wut_data[] = {
+        SI446X_WUT_CONFIG_LDC_RX | SI446X_WUT_CONFIG_WUT_EN | SI446X_WUT_CONFIG_CAL_EN,
+        static_cast<uint8_t>(wut.m >> 8),
+        static_cast<uint8_t>(wut.m & 0xFF),
+        static_cast<uint8_t>(SI446X_WUT_R_SLEEP | wut.r),
+        wut.ldc,
+    };
+    si446x_set_property_(&wut_args, wut_data);
+
+    // Tunes the windows to the channel. A valid packet is held in READY until it has been read.
+    this->start_rx_(this->listen_channel_(), SI446X_STATE_READY, SI446X_STATE_SLEEP);
+  }
+
+  this->si446x_change_state_(SI446X_STATE_SLEEP);
+  if (this->radio_fault_) {
+    return;
+  }
+  this->asleep_ = true;
+  this->wake_pending_tx_ = false;
+  this->metrics_.sleeps++;
+  TEMPERBRIDGE_LOG_HOT(TAG, "Radio asleep after %" PRIu32 " ms idle", millis() - this->idle_start_);
+}
+
+// Selecting the chip wakes it, and the first command then waits for CTS until the crystal is running. The wake-up
+// timer is stopped so it can't open RX windows under a transmission. Returns whether the radio was asleep.
+bool TemperBridgeComponent::wake_radio_() {
+  this->idle_start_ = millis();
+  if (!this->asleep_) {
+    return false;
+  }
+  this->asleep_ = false;
+  this->wake_start_ = micros();
+
+  if (this->receive_) {
+    Si446xSetPropertyArgs args = {
+        .group = SI446X_PROP_GROUP_GLOBAL,
+        .num_props = 1,
+        .start_prop = SI446X_PROP_GLOBAL_WUT_CONFIG,
+    };
+    uint8_t wut_config = 0;
+    si446x_set_property_(&args, &wut_config);
+  }
+  this->si446x_change_state_(SI446X_STATE_READY);
+  // Continuous RX is back as soon as the TX queue runs empty
+  this->rx_active_ = false;
+  return true;
+}
+
+void TemperBridgeComponent::apply_channel_(uint16_t channel) {
+  this->metrics_.channel_changes++;
   this->channel_ = channel;
-  if (this->initialized_) {
-    this->tune_channel_(channel);
+  if (this->initialized_ && !this->radio_fault_) {
+    this->select_channel_(channel);
+    if (this->rx_active_) {
+      this->start_rx_(this->listen_channel_());
+    }
+  }
+}
+
+void TemperBridgeComponent::set_channel(uint16_t channel) {
+  TEMPERBRIDGE_LOG_HOT(TAG, "channel: %u", channel);
+  // The config only validates constants, templated values get here unchecked
+  if (!temper_valid_channel(channel)) {
+    ESP_LOGW(TAG, "Ignoring invalid channel %u", channel);
+    return;
+  }
+  this->dispatch_({.type = RadioMessageType::SET_CHANNEL,
+                   .priority = TxPriority::NORMAL,
+                   .repeats = 0,
+                   .coalesce_key = 0,
+                   .channel = channel,
+                   .command = 0,
+                   .id = 0,
+                   .hold_ms = 0,
+                   .queued_at = 0});
+}
+
+// The bridge's channel, or the channel being scanned while learning
+uint16_t TemperBridgeComponent::listen_channel_() const {
+  return this->learning_ ? this->learn_channel_ : this->channel_.load();
+}
+
+// Puts the radio in RX. By default it re-arms itself after every packet, valid or not.
+void TemperBridgeComponent::start_rx_(uint16_t channel, uint8_t valid_state, uint8_t invalid_state) {
+  uint8_t rx_args[] = {
+      this->select_channel_(channel),
+      0,                       // condition
+      0,                       // RX_LEN 15:8, use the packet handler's field configuration
+      0,                       // RX_LEN 7:0
+      SI446X_STATE_NO_CHANGE,  // RXTIMEOUT_STATE
+      valid_state,             // RXVALID_STATE
+      invalid_state,           // RXINVALID_STATE
+  };
+  si446x_execute_command_(SI446X_CMD_START_RX, rx_args, sizeof(rx_args), nullptr, 0);
+  this->rx_active_ = true;
+}
+
+// Drains one packet from the RX FIFO in a single burst. Like WRITE_TX_FIFO this doesn't need to wait for CTS.
+void TemperBridgeComponent::read_rx_packet_() {
+  // Length byte followed by the packet
+  uint8_t fifo[1 + sizeof(TemperPacket)];
+  this->trace_(micros(), SI446X_CMD_READ_RX_FIFO, 0, 0, SPI_TRACE_FLAG_RESPONSE);
+  this->enable();
+  this->write_byte(SI446X_CMD_READ_RX_FIFO);
+  this->read_array(fifo, sizeof(fifo));
+  this->disable();
+
+  TemperPacket packet;
+  memcpy(&packet, fifo + 1, sizeof(TemperPacket));
+  if (fifo[0] != sizeof(TemperPacket) || temper_crc(fifo + 1, 6) != packet.crc) {
+    // Whatever is left in the FIFO can't be trusted to line up with packet boundaries anymore
+    Si446xFifoInfoResp fifo_info;
+    this->si446x_fifo_info_(&fifo_info, true, false);
+    this->rx_invalid_++;
+    return;
+  }
+
+  if (!this->rx_packets_.push(packet)) {
+    this->rx_dropped_++;
+  }
+}
+
+void TemperBridgeComponent::process_rx_packets_() {
+  TemperPacket packet;
+  while (this->rx_packets_.pop(&packet)) {
+    const uint32_t command = convert_big_endian(packet.cmd);
+    const uint16_t channel = convert_big_endian(packet.channel);
+    // The CRC is only one byte, and learning would adopt whatever channel the packet names
+    if (!temper_valid_channel(channel)) {
+      this->rx_invalid_++;
+      continue;
+    }
+    this->rx_received_++;
+    TEMPERBRIDGE_LOG_HOT(TAG, "Received command %08" PRIx32 " on channel %u", command, channel);
+    if (this->learning_ && (command & TEMPER_CMD_FAMILY_MASK) == TEMPER_CMD_BROADCAST_CH) {
+      this->finish_learning_(channel);
+    }
+    if (channel == this->channel_) {
+      this->mirror_remote_command_(command);
+    }
   }
 }
 
@@ -353,91 +1554,188 @@ void TemperBridgeComponent::si446x_fifo_info_(Si446xFifoInfoResp *ret, bool clea
   si446x_execute_command_(SI446X_CMD_FIFO_INFO, &arg, 1, (uint8_t *) ret, sizeof(Si446xFifoInfoResp));
 }
 
-void TemperBridgeComponent::si446x_start_tx_() {
+void TemperBridgeComponent::si446x_start_tx_(uint8_t channel, bool retransmit) {
   uint8_t tx_args[] = {
-      0x0,  // channel
-      0,    // condition
+      channel,
+      static_cast<uint8_t>(retransmit ? SI446X_START_TX_RETRANSMIT : 0),  // condition
   };
   si446x_execute_command_(SI446X_CMD_START_TX, tx_args, sizeof(tx_args), nullptr, 0);
 }
 
-inline float temper_frequency_for_channel(uint16_t channel) {
+// Channels up to here are spaced 1 fc apart, above it they are 2 fc apart
+static const uint16_t TEMPER_CHANNEL_SPACING_CHANGE = 8862;
+// Output divider for the 420-525 MHz band
+static const uint32_t SI446X_OUTDIV = 8;
+
+constexpr uint32_t temper_channel_fc(uint16_t channel) {
   // compute fc (from original Si4432 implementation)
-  const uint16_t fc = channel > 8862 ? ((2 * channel) + 10658) : channel + 19520;
-  return 10.0f * (19 + 24 + (fc / 64000.0f));
+  return channel > TEMPER_CHANNEL_SPACING_CHANGE ? ((2 * channel) + 10658) : channel + 19520;
+}
+
+// Channel frequency in units of 0.25 Hz, 430 MHz + fc * 156.25 Hz, which is exact
+constexpr uint32_t temper_channel_frequency_qhz(uint16_t channel) {
+  return 4 * 430000000UL + 625 * temper_channel_fc(channel);
+}
+
+// Exact FREQ_CONTROL_INTE/FRAC for a channel, packed as inte << 24 | frac. N = freq / (2 * xo / outdiv) is computed
+// in 19 bit fixed point and truncated; FRAC carries 1 + the fractional part of N so INTE is one less than its
+// integer part.
+constexpr uint32_t temper_freq_control(uint16_t channel) {
+  const uint64_t n = (static_cast<uint64_t>(temper_channel_frequency_qhz(channel)) << 19) * SI446X_OUTDIV /
+                     (2ULL * RADIO_CONFIGURATION_DATA_RADIO_XO_FREQ * 4);
+  const uint32_t inte = static_cast<uint32_t>(n >> 19) - 1;
+  return (inte << 24) | static_cast<uint32_t>(n - (static_cast<uint64_t>(inte) << 19));
+}
+
+// Checks every channel against N * 2^19 = (fc + 2752000) * 4096 / 375, which is the same ratio reduced by hand for
+// the 30 MHz crystal, and that FRAC always lands in [2^19, 2^20).
+constexpr bool temper_freq_control_verify() {
+  for (uint32_t channel = 1; channel <= TEMPER_MAX_CHANNEL; channel++) {
+    const uint32_t freq_control = temper_freq_control(channel);
+    const uint64_t frac = freq_control & 0xFFFFFF;
+    const uint64_t n = ((static_cast<uint64_t>(freq_control >> 24) + 1) << 19) + frac - (1 << 19);
+    const uint64_t reference = (temper_channel_fc(channel) + 2752000ULL) * 4096;
+    if (n * 375 > reference || (n + 1) * 375 <= reference || frac < (1 << 19) || frac >= (1 << 20)) {
+      return false;
+    }
+  }
+  return true;
 }
 
-// TODO these methods should go in the si446x file
+// The expected values are worked out for the 30 MHz crystal, other WDS configurations aren't checked
+#if RADIO_CONFIGURATION_DATA_RADIO_XO_FREQ == 30000000L
+static_assert(temper_freq_control_verify(), "FREQ_CONTROL calculation is off");
+static_assert(temper_freq_control(1) == 0x380DEB90, "channel 1");
+static_assert(temper_freq_control(8862) == 0x380F65A1, "channel 8862");
+static_assert(temper_freq_control(8863) == 0x380F65B7, "channel 8863");
+static_assert(temper_freq_control(10111) == 0x380FD036, "channel 10111");
+#endif
+
+#ifdef USE_TEMPERBRIDGE_FREQ_TABLE
+// Precomputed FREQ_CONTROL values for channels 1..10111, split into 16 bit halves so they can be read from flash
+// with progmem_read_uint16 on ESP8266
+struct TemperFreqControlTable {
+  uint16_t high[TEMPER_MAX_CHANNEL];
+  uint16_t low[TEMPER_MAX_CHANNEL];
+
+  constexpr TemperFreqControlTable() : high(), low() {
+    for (uint16_t channel = 1; channel <= TEMPER_MAX_CHANNEL; channel++) {
+      const uint32_t freq_control = temper_freq_control(channel);
+      this->high[channel - 1] = freq_control >> 16;
+      this->low[channel - 1] = freq_control & 0xFFFF;
+    }
+  }
+};
+
+static const TemperFreqControlTable TEMPER_FREQ_CONTROL_TABLE PROGMEM = TemperFreqControlTable();
+#endif
+
 void temper_calculate_freq_control(uint16_t channel, uint8_t *freq_control_inte, uint32_t *freq_control_frac) {
   assert(channel >= 1);
-  assert(channel <= 10111);
+  assert(channel <= TEMPER_MAX_CHANNEL);
   assert(freq_control_inte != nullptr);
   assert(freq_control_frac != nullptr);
 
-  // TODO compiler warnings
-  // oscillator frequency in Hz
-  const float freq_xo = 0x01C9C380;
-
-  const float freq_mhz = temper_frequency_for_channel(channel);
-  const float freq_hz = pow10f(6) * freq_mhz;
+#ifdef USE_TEMPERBRIDGE_FREQ_TABLE
+  const uint32_t freq_control = (progmem_read_uint16(&TEMPER_FREQ_CONTROL_TABLE.high[channel - 1]) << 16) |
+                                progmem_read_uint16(&TEMPER_FREQ_CONTROL_TABLE.low[channel - 1]);
+#else
+  const uint32_t freq_control = temper_freq_control(channel);
+#endif
 
-  const float N = freq_hz / ((2 * freq_xo) / 8);
-
-  float integ;
-  float frac = modff(N, &integ);
+  *freq_control_frac = freq_control & 0xFFFFFF;
+  *freq_control_inte = freq_control >> 24;
+}
 
-  integ--;
-  frac++;
-  assert(frac >= 1 && frac <= 2);
+// Channel step size for EZ frequency programming, in FREQ_CONTROL_FRAC units. One fc is 156.25 Hz, or 4096/375 of a
+// FRAC LSB, so the step is rounded; the error stays below 600 Hz across a 256 channel window, well inside the
+// crystal tolerance.
+inline uint16_t temper_channel_step_size(uint16_t channel) {
+  const uint32_t fc_per_channel = channel > TEMPER_CHANNEL_SPACING_CHANGE ? 2 : 1;
+  return (fc_per_channel * 4096 + 375 / 2) / 375;
+}
 
-  *freq_control_frac = frac * powf(2, 19);
-  *freq_control_inte = integ;
+// First channel of the EZ window containing this channel. Windows are aligned so that beds on nearby channels share
+// one, and never straddle the change in channel spacing.
+inline uint16_t temper_ez_base_channel(uint16_t channel) {
+  const uint16_t segment_start = channel > TEMPER_CHANNEL_SPACING_CHANGE ? TEMPER_CHANNEL_SPACING_CHANGE + 1 : 1;
+  return channel - ((channel - segment_start) % (SI446X_MAX_EZ_CHANNEL + 1));
 }
 
-void TemperBridgeComponent::si446x_set_freq_control_properties_(uint8_t freq_control_inte, uint32_t freq_control_frac) {
+void TemperBridgeComponent::si446x_set_freq_control_properties_(uint8_t freq_control_inte, uint32_t freq_control_frac,
+                                                                uint16_t channel_step_size) {
   Si446xSetPropertyArgs args = {
-      .group = 0x40,  // TODO don't hardcode
-      .num_props = 4,
-      .start_prop = 0x00  // TODO don't hardcode
+      .group = SI446X_PROP_GROUP_FREQ_CONTROL,
+      .num_props = 6,
+      .start_prop = SI446X_PROP_FREQ_CONTROL_INTE,
   };
 
-  uint8_t data[] = {freq_control_inte, static_cast<uint8_t>((freq_control_frac & 0xFFFF00) >> 16),
+  uint8_t data[] = {freq_control_inte,
+                    static_cast<uint8_t>((freq_control_frac & 0xFFFF00) >> 16),
                     static_cast<uint8_t>((freq_control_frac & 0xFF00) >> 8),
-                    static_cast<uint8_t>(freq_control_frac & 0xFF)};
+                    static_cast<uint8_t>(freq_control_frac & 0xFF),
+                    static_cast<uint8_t>(channel_step_size >> 8),
+                    static_cast<uint8_t>(channel_step_size & 0xFF)};
   si446x_set_property_(&args, data);
 }
 
+// Writes through the property shadow: only the span of properties whose value differs from what the chip already
+// holds goes out, and nothing at all when none do.
 void TemperBridgeComponent::si446x_set_property_(Si446xSetPropertyArgs *args, uint8_t *data) {
   static_assert(sizeof(Si446xSetPropertyArgs) == 3, "wrong size");
+  uint8_t first = args->num_props;
+  uint8_t last = 0;
+  for (uint8_t i = 0; i < args->num_props; i++) {
+    if (!this->property_shadow_.matches(args->group, args->start_prop + i, data[i])) {
+      if (first == args->num_props) {
+        first = i;
+      }
+      last = i;
+    }
+  }
+  if (first == args->num_props) {
+    this->property_writes_skipped_++;
+    return;
+  }
+
+  const Si446xSetPropertyArgs changed = {
+      .group = args->group,
+      .num_props = static_cast<uint8_t>(last - first + 1),
+      .start_prop = static_cast<uint8_t>(args->start_prop + first),
+  };
   uint8_t cts;
-  uint8_t full_args[sizeof(Si446xSetPropertyArgs) + args->num_props];
-  memcpy(full_args, (uint8_t *) args, sizeof(Si446xSetPropertyArgs));
-  memcpy(full_args + sizeof(Si446xSetPropertyArgs), data, args->num_props);
+  si446x_raw_command_(SI446X_CMD_SET_PROPERTY, (const uint8_t *) &changed, sizeof(Si446xSetPropertyArgs), data + first,
+                      changed.num_props, &cts, 1);
+  if (this->radio_fault_) {
+    return;
+  }
+  for (uint8_t i = 0; i < changed.num_props; i++) {
+    this->property_shadow_.store(changed.group, changed.start_prop + i, data[first + i]);
+  }
+  if (this->verify_properties_) {
+    this->si446x_verify_properties_(changed.group, changed.start_prop, changed.num_props);
+  }
+}
 
-  si446x_execute_command_(SI446X_CMD_SET_PROPERTY, full_args, sizeof(full_args), &cts, 1);
+// Reads the properties back from the chip and compares them with the shadow, only with verify_properties
+void TemperBridgeComponent::si446x_verify_properties_(uint8_t group, uint8_t start_prop, uint8_t num_props) {
+  Si446xGetPropertyArgs args = {.group = group, .num_props = num_props, .start_prop = start_prop};
+  uint8_t props[SI446X_MAX_GET_PROPERTY_PROPS];
+  si446x_get_property_(&args, props);
+  for (uint8_t i = 0; i < num_props; i++) {
+    uint8_t expected;
+    if (this->property_shadow_.load(group, start_prop + i, &expected) && expected != props[i]) {
+      ESP_LOGW(TAG, "Property %02x/%02x is %02x, expected %02x", group, start_prop + i, props[i], expected);
+      this->property_shadow_.store(group, start_prop + i, props[i]);
+    }
+  }
 }
 
 void TemperBridgeComponent::si446x_get_property_(Si446xGetPropertyArgs *args, uint8_t *props) {
   static_assert(sizeof(Si446xGetPropertyArgs) == 3, "wrong size");
-  uint8_t resp[args->num_props];
-  si446x_execute_command_(SI446X_CMD_GET_PROPERTY, (uint8_t *) args, sizeof(Si446xGetPropertyArgs), (uint8_t *) resp,
+  assert(args->num_props <= SI446X_MAX_GET_PROPERTY_PROPS);
+  si446x_execute_command_(SI446X_CMD_GET_PROPERTY, (uint8_t *) args, sizeof(Si446xGetPropertyArgs), props,
                           args->num_props);
-  memcpy(props, resp, args->num_props);
-}
-
-void TemperBridgeComponent::si446x_get_freq_control_properties_(uint8_t *freq_control_inte,
-                                                                uint32_t *freq_control_frac) {
-  Si446xGetPropertyArgs args = {
-      .group = 0x40,  // TODO don't hardcode
-      .num_props = 4,
-      .start_prop = 0x00  // TODO don't hardcode
-  };
-
-  uint8_t freq_props[4] = {0};
-  si446x_get_property_(&args, freq_props);
-
-  *freq_control_inte = freq_props[0];
-  *freq_control_frac = freq_props[3] | (freq_props[2] << 8) | (freq_props[1] << 16);
 }
 
 void TemperBridgeComponent::tune_channel_(uint16_t channel) {
@@ -445,18 +1743,31 @@ void TemperBridgeComponent::tune_channel_(uint16_t channel) {
   uint32_t calc_frac;
   temper_calculate_freq_control(channel, &calc_inte, &calc_frac);
 
-  ESP_LOGI(TAG, "calculated frac: %08" PRIx32, calc_frac);
-  ESP_LOGI(TAG, "calculated inte: %x", calc_inte);
+  TEMPERBRIDGE_LOG_HOT(TAG, "Tuning to channel %u: inte %x, frac %06" PRIx32, channel, calc_inte, calc_frac);
 
-  si446x_set_freq_control_properties_(calc_inte, calc_frac);
+  const uint16_t step_size = this->ez_frequency_programming_ ? temper_channel_step_size(channel) : 0;
+  si446x_set_freq_control_properties_(calc_inte, calc_frac, step_size);
 
-  delay(50);
+  this->tuned_channel_ = channel;
+  this->tuned_channel_valid_ = true;
+}
 
-  uint32_t read_frac;
-  uint8_t read_inte;
-  si446x_get_freq_control_properties_(&read_inte, &read_frac);
-  ESP_LOGI(TAG, "read frac: %08" PRIx32, read_frac);
-  ESP_LOGI(TAG, "read inte: %x", read_inte);
+// Returns the START_TX/START_RX channel number that puts the radio on the given Temper channel. With EZ frequency
+// programming the synthesizer is only retuned when the channel lies outside the current window, so switching between
+// channels inside it costs no SPI traffic at all.
+uint8_t TemperBridgeComponent::select_channel_(uint16_t channel) {
+  if (!this->ez_frequency_programming_) {
+    if (!this->tuned_channel_valid_ || this->tuned_channel_ != channel) {
+      this->tune_channel_(channel);
+    }
+    return 0;
+  }
+
+  const uint16_t base = temper_ez_base_channel(channel);
+  if (!this->tuned_channel_valid_ || this->tuned_channel_ != base) {
+    this->tune_channel_(base);
+  }
+  return channel - base;
 }
 
 // This one seems to be used when making adjustments to built-in modes
@@ -467,42 +1778,302 @@ void TemperBridgeComponent::tune_channel_(uint16_t channel) {
 #define TEMPER_MASSAGE_TYPE_LUMBAR 0X00000100
 #define TEMPER_MASSAGE_TYPE_LEG 0X00000200
 
-#define TEMPER_MASSAGE_LEVEL_STEP 0x18
+#define TEMPER_MASSAGE_TYPE_MASK 0X0000FF00
 
-void TemperBridgeComponent::set_massage_level(MassageTarget target, uint8_t level) {
-  uint32_t command =
-      this->massage_command_mode_ == MassageCommandMode::BUILTIN ? TEMPER_MASSAGE_MAGIC_1 : TEMPER_MASSAGE_MAGIC_2;
+#define TEMPER_MASSAGE_LEVEL_STEP 0x18
+#define TEMPER_MASSAGE_MAX_LEVEL 10
 
+uint32_t TemperBridgeComponent::set_massage_level(MassageTarget target, uint8_t level) {
   switch (target) {
     case MassageTarget::HEAD:
       if (this->massage_head_intensity_ == level) {
-        return;
+        return 0;
       }
       this->massage_head_intensity_ = level;
-      command |= TEMPER_MASSAGE_TYPE_HEAD;
       break;
     case MassageTarget::LEGS:
       if (this->massage_leg_intensity_ == level) {
-        return;
+        return 0;
       }
       this->massage_leg_intensity_ = level;
-      command |= TEMPER_MASSAGE_TYPE_LEG;
       break;
     case MassageTarget::LUMBAR:
       if (this->massage_lumbar_intensity_ == level) {
-        return;
+        return 0;
       }
       this->massage_lumbar_intensity_ = level;
+      break;
+  }
+  this->state_callback_.call();
+
+  if (this->massage_coalesce_window_ == 0) {
+    return this->send_massage_level_(target, 0);
+  }
+
+  // Restarting the named timeout drops the previous one, so only the newest level in the window goes on air. The
+  // request id is handed out now so callers can wait on it while the window is open.
+  const uint8_t index = static_cast<uint8_t>(target);
+  this->supersede_massage_level_(target);
+  const uint32_t id = this->allocate_tx_id_();
+  this->massage_pending_ids_[index] = id;
+  this->set_timeout(MASSAGE_COALESCE_TIMEOUTS[index], this->massage_coalesce_window_, [this, target, index, id]() {
+    this->massage_pending_ids_[index] = 0;
+    this->send_massage_level_(target, id);
+  });
+  return id;
+}
+
+// Reports a level still waiting out its coalesce window as done, a newer level or STOP replaces it
+void TemperBridgeComponent::supersede_massage_level_(MassageTarget target) {
+  const uint8_t index = static_cast<uint8_t>(target);
+  const uint32_t id = this->massage_pending_ids_[index];
+  if (id != 0) {
+    this->massage_pending_ids_[index] = 0;
+    this->tx_complete_callback_.call(id, false);
+  }
+}
+
+uint32_t TemperBridgeComponent::send_massage_level_(MassageTarget target, uint32_t id) {
+  uint32_t command =
+      this->massage_command_mode_ == MassageCommandMode::BUILTIN ? TEMPER_MASSAGE_MAGIC_1 : TEMPER_MASSAGE_MAGIC_2;
+  uint8_t level = 0;
+
+  switch (target) {
+    case MassageTarget::HEAD:
+      level = this->massage_head_intensity_;
+      command |= TEMPER_MASSAGE_TYPE_HEAD;
+      break;
+    case MassageTarget::LEGS:
+      level = this->massage_leg_intensity_;
+      command |= TEMPER_MASSAGE_TYPE_LEG;
+      break;
+    case MassageTarget::LUMBAR:
+      level = this->massage_lumbar_intensity_;
       command |= TEMPER_MASSAGE_TYPE_LUMBAR;
       break;
   }
 
   command |= TEMPER_MASSAGE_LEVEL_STEP * level;
 
-  // TODO: De-dupe
-  for (int i = 0; i < 3; i++) {
-    this->transmit_command_(static_cast<uint32_t>(command));
+  return this->queue_command_(command, 3, TxPriority::NORMAL, static_cast<uint8_t>(target) + 1, id);
+}
+
+#ifdef USE_TEMPERBRIDGE_BENCHMARK
+// Times the protocol hot paths on the target itself. The result is logged by dump_config as one JSON line so it can
+// be scraped from the logs and compared between firmware builds.
+void TemperBridgeComponent::run_benchmark_() {
+  static const uint32_t ITERATIONS = 1000;
+  static const uint32_t CONFIG_ITERATIONS = 100;
+  volatile uint32_t sink = 0;
+  uint8_t packet_bytes[TEMPER_TX_FIFO_WRITE_BYTES];
+
+  uint32_t start = micros();
+  for (uint32_t i = 0; i < ITERATIONS; i++) {
+    packet_bytes[2] = i;
+    sink += temper_crc(packet_bytes + 2, 6);
+  }
+  this->benchmark_.crc_ns = (micros() - start) * 1000 / ITERATIONS;
+
+  start = micros();
+  for (uint32_t i = 0; i < ITERATIONS; i++) {
+    temper_build_packet(static_cast<uint32_t>(TemperCommand::STOP), i, packet_bytes);
+    sink += packet_bytes[8];
+  }
+  this->benchmark_.packet_build_ns = (micros() - start) * 1000 / ITERATIONS;
+
+  start = micros();
+  for (uint16_t channel = 1; channel <= TEMPER_MAX_CHANNEL; channel++) {
+    uint8_t inte;
+    uint32_t frac;
+    temper_calculate_freq_control(channel, &inte, &frac);
+    sink += frac;
+  }
+  this->benchmark_.freq_calc_ns = (micros() - start) * 1000 / TEMPER_MAX_CHANNEL;
+
+  start = micros();
+  for (uint32_t i = 0; i < CONFIG_ITERATIONS; i++) {
+    si446x_walk_configuration(SI4463_RADIO_CONFIGURATION_DATA_ARRAY, this->merge_config_properties_,
+                              [&sink](const uint8_t *command, size_t size_bytes) { sink += size_bytes; });
+  }
+  this->benchmark_.config_parse_ns = (micros() - start) * 1000 / CONFIG_ITERATIONS;
+}
+#endif
+
+// The channel filter is about 76 kHz wide, so a dwell tuned to one channel hears remotes up to ~128 channels (20 kHz)
+// either side of it. Above the spacing change channels are twice as far apart.
+static const uint16_t TEMPER_LEARN_FIRST_CHANNEL = 64;
+static const uint16_t TEMPER_LEARN_STEP = 128;
+
+void TemperBridgeComponent::start_channel_learning() {
+  this->dispatch_({.type = RadioMessageType::START_LEARNING,
+                   .priority = TxPriority::NORMAL,
+                   .repeats = 0,
+                   .coalesce_key = 0,
+                   .channel = 0,
+                   .command = 0,
+                   .id = 0,
+                   .hold_ms = 0,
+                   .queued_at = 0});
+}
+
+void TemperBridgeComponent::begin_learning_() {
+  if (this->learning_) {
+    return;
+  }
+  ESP_LOGI(TAG, "Learning channel, press a button on the remote");
+  this->learning_ = true;
+  this->learn_start_ = millis();
+  this->learn_hop_start_ = this->learn_start_;
+  this->learn_channel_ = TEMPER_LEARN_FIRST_CHANNEL;
+  if (this->tx_state_ == TxState::IDLE) {
+    this->start_rx_(this->listen_channel_());
+  }
+}
+
+void TemperBridgeComponent::service_learning_() {
+  const uint32_t now = millis();
+  if (now - this->learn_start_ > this->learn_timeout_) {
+    ESP_LOGW(TAG, "No remote heard while learning the channel");
+    this->stop_learning_();
+    return;
+  }
+
+  // Hop only while the radio is ours, transmissions keep the current dwell going
+  if (this->tx_state_ != TxState::IDLE || now - this->learn_hop_start_ < this->learn_dwell_time_) {
+    return;
+  }
+  this->learn_hop_start_ = now;
+
+  const uint16_t step =
+      this->learn_channel_ > TEMPER_CHANNEL_SPACING_CHANGE ? TEMPER_LEARN_STEP / 2 : TEMPER_LEARN_STEP;
+  uint16_t next = this->learn_channel_ + step;
+  if (this->learn_channel_ <= TEMPER_CHANNEL_SPACING_CHANGE && next > TEMPER_CHANNEL_SPACING_CHANGE) {
+    next = TEMPER_CHANNEL_SPACING_CHANGE + 1 + TEMPER_LEARN_FIRST_CHANNEL / 2;
+  } else if (next > TEMPER_MAX_CHANNEL) {
+    next = TEMPER_LEARN_FIRST_CHANNEL;
+  }
+  this->learn_channel_ = next;
+  this->start_rx_(this->listen_channel_());
+}
+
+void TemperBridgeComponent::finish_learning_(uint16_t channel) {
+  this->dispatch_({.type = RadioMessageType::FINISH_LEARNING,
+                   .priority = TxPriority::NORMAL,
+                   .repeats = 0,
+                   .coalesce_key = 0,
+                   .channel = channel,
+                   .command = 0,
+                   .id = 0,
+                   .hold_ms = 0,
+                   .queued_at = 0});
+}
+
+void TemperBridgeComponent::complete_learning_(uint16_t channel) {
+  // Several packets from the remote may have been heard before the first one got here
+  if (!this->learning_) {
+    return;
+  }
+  ESP_LOGI(TAG, "Learned channel %u", channel);
+  this->stop_learning_();
+  this->apply_channel_(channel);
+  // The callbacks run on the main loop
+  this->channels_learned_.push(channel);
+}
+
+void TemperBridgeComponent::stop_learning_() {
+  this->learning_ = false;
+  if (this->tx_state_ != TxState::IDLE) {
+    return;
+  }
+  if (this->receive_) {
+    this->start_rx_(this->listen_channel_());
+  } else {
+    this->si446x_change_state_(SI446X_STATE_READY);
+    this->rx_active_ = false;
+  }
+}
+
+void TemperBridgeComponent::si446x_get_modem_status_(Si446xModemStatusResp *ret) {
+  static_assert(sizeof(Si446xModemStatusResp) == 8, "wrong size");
+  // Leave the pending modem interrupts alone
+  const uint8_t arg = 0xFF;
+  si446x_execute_command_(SI446X_CMD_GET_MODEM_STATUS, &arg, 1, (uint8_t *) ret, sizeof(Si446xModemStatusResp));
+}
+
+void TemperBridgeComponent::si446x_change_state_(uint8_t state) {
+  si446x_execute_command_(SI446X_CMD_CHANGE_STATE, &state, 1, nullptr, 0);
+}
+
+uint8_t TemperBridgeComponent::get_massage_level(MassageTarget target) const {
+  switch (target) {
+    case MassageTarget::HEAD:
+      return this->massage_head_intensity_;
+    case MassageTarget::LEGS:
+      return this->massage_leg_intensity_;
+    case MassageTarget::LUMBAR:
+      return this->massage_lumbar_intensity_;
+  }
+  return 0;
+}
+
+void TemperBridgeComponent::set_massage_state_(uint8_t level, MassageCommandMode mode) {
+  this->massage_head_intensity_ = level;
+  this->massage_leg_intensity_ = level;
+  this->massage_lumbar_intensity_ = level;
+  this->massage_command_mode_ = mode;
+  this->state_callback_.call();
+}
+
+// For every STOP the bridge sends. Levels still waiting out their coalesce window would only start massage again.
+void TemperBridgeComponent::stop_massage_() {
+  this->set_massage_state_(0, MassageCommandMode::CUSTOM);
+  for (uint8_t i = 0; i < this->massage_pending_ids_.size(); i++) {
+    this->cancel_timeout(MASSAGE_COALESCE_TIMEOUTS[i]);
+    this->supersede_massage_level_(static_cast<MassageTarget>(i));
+  }
+}
+
+// Follows what a physical remote on our channel just sent, so the early return in set_massage_level compares against
+// what the base is really doing
+void TemperBridgeComponent::mirror_remote_command_(uint32_t command) {
+  if ((command & TEMPER_CMD_FAMILY_MASK) != TEMPER_CMD_BROADCAST_CH) {
+    return;
+  }
+
+  const uint32_t opcode = command & TEMPER_CMD_OPCODE_MASK;
+  if (command == static_cast<uint32_t>(TemperCommand::STOP)) {
+    this->set_massage_state_(0, MassageCommandMode::CUSTOM);
+    return;
+  }
+  if (opcode == TEMPER_MASSAGE_MODE) {
+    this->set_massage_state_(TEMPER_MASSAGE_PRESET_LEVEL, MassageCommandMode::BUILTIN);
+    return;
+  }
+  if (opcode != TEMPER_MASSAGE_MAGIC_1 && opcode != TEMPER_MASSAGE_MAGIC_2) {
+    return;
+  }
+
+  const uint8_t level = (command & 0xFF) / TEMPER_MASSAGE_LEVEL_STEP;
+  if (level > TEMPER_MASSAGE_MAX_LEVEL) {
+    return;
+  }
+
+  this->massage_command_mode_ =
+      opcode == TEMPER_MASSAGE_MAGIC_1 ? MassageCommandMode::BUILTIN : MassageCommandMode::CUSTOM;
+  switch (command & TEMPER_MASSAGE_TYPE_MASK) {
+    case TEMPER_MASSAGE_TYPE_HEAD:
+      this->massage_head_intensity_ = level;
+      break;
+    case TEMPER_MASSAGE_TYPE_LEG:
+      this->massage_leg_intensity_ = level;
+      break;
+    case TEMPER_MASSAGE_TYPE_LUMBAR:
+      this->massage_lumbar_intensity_ = level;
+      break;
+    default:
+      return;
   }
+  this->state_callback_.call();
 }
 
 }  // namespace temperbridge
@@ -2,10 +2,42 @@
 #include "esphome/components/spi/spi.h"
 #include "esphome/core/log.h"
 #include "esphome/core/automation.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/defines.h"
+
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
+
+#include <array>
+#include <cmath>
+#include <atomic>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#ifdef USE_TEMPERBRIDGE_RADIO_TASK
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
 
 #ifndef ESPHOME_TEMPERBRIDGE_H
 #define ESPHOME_TEMPERBRIDGE_H
 
+// Per-packet and per-command logging. A line on a 115200 baud UART blocks for milliseconds, so these only exist with
+// debug_log, everything else is counted instead.
+#ifdef USE_TEMPERBRIDGE_DEBUG_LOG
+#define TEMPERBRIDGE_LOG_HOT(tag, ...) ESP_LOGD(tag, __VA_ARGS__)
+#else
+// Still type checks the arguments and keeps them "used", but never emits anything
+#define TEMPERBRIDGE_LOG_HOT(tag, ...) \
+  do { \
+    if (false) { \
+      ESP_LOGD(tag, __VA_ARGS__); \
+    } \
+  } while (0)
+#endif
+
 namespace esphome {
 namespace temperbridge {
 
@@ -33,6 +65,11 @@ enum class PositionCommand {
   LOWER_LEGS,
 };
 
+enum class PositionAxis : uint8_t {
+  HEAD,
+  LEGS,
+};
+
 enum class MassageTarget {
   HEAD,
   LEGS,
@@ -44,6 +81,275 @@ enum class MassageCommandMode {
   CUSTOM,
 };
 
+enum class TxState {
+  IDLE,
+  CLEAR_CHANNEL_ASSESSMENT,
+  WAIT_PACKET_SENT,
+  WAIT_GAP,
+};
+
+enum class TxPriority : uint8_t {
+  NORMAL,
+  // STOP and anything else that has to reach the base right away
+  HIGH,
+};
+
+struct TxRequest {
+  uint32_t command;
+  uint16_t channel;
+  uint8_t repeats;
+  TxPriority priority;
+  // Queued requests with the same non-zero key replace each other
+  uint8_t coalesce_key;
+  uint32_t id;
+  // Keep repeating for at least this long after the first packet
+  uint32_t hold_ms;
+  // micros() when the command was handed to the radio
+  uint32_t queued_at;
+};
+
+enum class TxEventType : uint8_t {
+  // The first packet is about to go out
+  STARTED,
+  // The last repeat has left the radio
+  SENT,
+  // Dropped or replaced before its last repeat went out
+  DROPPED,
+};
+
+struct TxEvent {
+  uint32_t id;
+  TxEventType type;
+};
+
+// Fixed capacity FIFO, nothing is allocated after construction
+template<typename T, size_t N> class BoundedQueue {
+ public:
+  bool push(const T &item) {
+    if (this->count_ == N) {
+      return false;
+    }
+    this->items_[(this->head_ + this->count_) % N] = item;
+    this->count_++;
+    return true;
+  }
+
+  T pop() {
+    const T item = this->items_[this->head_];
+    this->head_ = (this->head_ + 1) % N;
+    this->count_--;
+    return item;
+  }
+
+  T &operator[](size_t index) { return this->items_[(this->head_ + index) % N]; }
+  const T &front() const { return this->items_[this->head_]; }
+
+  void clear() { this->count_ = 0; }
+  bool empty() const { return this->count_ == 0; }
+  size_t size() const { return this->count_; }
+
+ protected:
+  std::array<T, N> items_{};
+  size_t head_ = 0;
+  size_t count_ = 0;
+};
+
+// Lock-free ring buffer for exactly one producer and one consumer. Holds up to N - 1 items.
+template<typename T, size_t N> class SpscRingBuffer {
+ public:
+  bool push(const T &item) {
+    const size_t head = this->head_.load(std::memory_order_relaxed);
+    const size_t next = (head + 1) % N;
+    if (next == this->tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    this->items_[head] = item;
+    this->head_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T *item) {
+    const size_t tail = this->tail_.load(std::memory_order_relaxed);
+    if (tail == this->head_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    *item = this->items_[tail];
+    this->tail_.store((tail + 1) % N, std::memory_order_release);
+    return true;
+  }
+
+ protected:
+  std::array<T, N> items_{};
+  std::atomic<size_t> head_{0};
+  std::atomic<size_t> tail_{0};
+};
+
+enum class RadioMessageType : uint8_t {
+  QUEUE_COMMAND,
+  SET_CHANNEL,
+  START_LEARNING,
+  FINISH_LEARNING,
+};
+
+// Work handed to whatever owns the radio, the main loop or the radio task
+struct RadioMessage {
+  RadioMessageType type;
+  TxPriority priority;
+  uint8_t repeats;
+  uint8_t coalesce_key;
+  uint16_t channel;
+  uint32_t command;
+  uint32_t id;
+  uint32_t hold_ms;
+  uint32_t queued_at;
+};
+
+// Histogram of microsecond durations in power of two buckets: bucket i holds values below 2^i us, the last one
+// everything above. Fixed size, recording is a few instructions.
+class LatencyHistogram {
+ public:
+  static const size_t BUCKETS = 24;
+
+  void record(uint32_t value_us) {
+    size_t bucket = 0;
+    while (bucket < BUCKETS - 1 && value_us >= (1u << bucket)) {
+      bucket++;
+    }
+    this->buckets_[bucket]++;
+    this->count_++;
+    this->sum_ += value_us;
+    if (value_us > this->max_) {
+      this->max_ = value_us;
+    }
+  }
+
+  // Upper bound of the bucket holding the given quantile (0..1), 0 when nothing was recorded
+  uint32_t percentile(float quantile) const {
+    const uint32_t rank = this->count_ * quantile;
+    uint32_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+      seen += this->buckets_[i];
+      if (seen > rank) {
+        return i == BUCKETS - 1 ? this->max_ : (1u << i);
+      }
+    }
+    return 0;
+  }
+
+  // What was recorded since an earlier copy of this histogram, the max is kept as is
+  LatencyHistogram since(const LatencyHistogram &earlier) const {
+    LatencyHistogram ret = *this;
+    for (size_t i = 0; i < BUCKETS; i++) {
+      ret.buckets_[i] -= earlier.buckets_[i];
+    }
+    ret.count_ -= earlier.count_;
+    ret.sum_ -= earlier.sum_;
+    return ret;
+  }
+
+  uint32_t count() const { return this->count_; }
+  uint32_t mean() const { return this->count_ == 0 ? 0 : this->sum_ / this->count_; }
+  uint32_t max() const { return this->max_; }
+  uint32_t bucket(size_t index) const { return this->buckets_[index]; }
+
+ protected:
+  std::array<uint32_t, BUCKETS> buckets_{};
+  uint32_t count_ = 0;
+  uint64_t sum_ = 0;
+  uint32_t max_ = 0;
+};
+
+// Written where the radio is serviced. With the radio task the main loop only copies or resets it under radio_lock_.
+struct RadioMetrics {
+  // From the action queueing a command to its first packet going out
+  LatencyHistogram action_latency;
+  // Loading the FIFO and starting TX for one packet
+  LatencyHistogram packet_spi;
+  // From starting TX to PACKET_SENT
+  LatencyHistogram packet_air;
+  uint32_t packets_sent;
+  uint32_t channel_changes;
+  LatencyHistogram cts_wait;
+  uint32_t cts_polls;
+  uint32_t packet_sent_timeouts;
+  // From waking the radio for a queued command to its START_TX
+  LatencyHistogram wake_latency;
+  uint32_t sleeps;
+  // Interrupt flags cleared over SPI, and interrupts that didn't need it
+  uint32_t int_clears;
+  uint32_t int_clears_skipped;
+  // Requests waiting when a new one was queued
+  uint8_t queue_depth;
+  uint8_t queue_depth_max;
+};
+
+// One queued move of an axis, from its motion command to the STOP after it
+struct AxisSegment {
+  uint32_t motion_id;
+  uint32_t end_id;
+  int8_t direction;
+  float end_stop;
+  uint32_t start;
+  bool started;
+};
+
+struct AxisPosition {
+  // 0 flat to 1 fully raised, NAN while unknown
+  float position{NAN};
+  // Where the axis ends up once every queued move is done
+  float planned{NAN};
+  uint32_t travel_time{30000};
+  BoundedQueue<AxisSegment, 4> segments;
+#ifdef USE_SENSOR
+  sensor::Sensor *sensor{nullptr};
+#endif
+};
+
+struct RadioBootTiming {
+  uint32_t reset_us;
+  uint32_t part_info_us;
+  uint32_t config_us;
+  uint32_t tune_us;
+  uint32_t total_us;
+  uint16_t config_commands;
+};
+
+struct TemperBridgeBenchmark {
+  uint32_t crc_ns;
+  uint32_t packet_build_ns;
+  uint32_t freq_calc_ns;
+  uint32_t config_parse_ns;
+};
+
+struct TemperBridgeStore {
+  ISRInternalGPIOPin pin;
+  volatile bool irq_pending{false};
+#ifdef USE_TEMPERBRIDGE_RADIO_TASK
+  TaskHandle_t task{nullptr};
+#endif
+
+  static void gpio_intr(TemperBridgeStore *arg);
+};
+
+#ifdef USE_TEMPERBRIDGE_TRACE
+// One SPI transaction as seen by the tracer. scripts/decode_trace.py knows this layout.
+struct SpiTraceEntry {
+  uint32_t timestamp_us;
+  uint8_t opcode;
+  // Bytes clocked out after the opcode
+  uint8_t length;
+  // CTS polls before and after the command, saturating
+  uint8_t cts_polls;
+  uint8_t flags;
+} PACKED;
+
+static const size_t SPI_TRACE_ENTRIES = 256;
+#endif
+
+// SpiTraceEntry flags
+static const uint8_t SPI_TRACE_FLAG_RESPONSE = 1 << 0;
+static const uint8_t SPI_TRACE_FLAG_CTS_TIMEOUT = 1 << 1;
+
 struct TemperPacket {
   uint32_t cmd;
   uint16_t channel;
@@ -56,85 +362,445 @@ class TemperBridgeComponent : public Component,
  public:
   void setup() override;
   void loop() override;
+  void dump_config() override;
 
   void set_interrupt_pin(InternalGPIOPin *pin) { this->interrupt_pin_ = pin; }
 
   void set_sdn_pin(GPIOPin *pin) { this->sdn_pin_ = pin; }
 
-  void execute_simple_command(SimpleCommand cmd);
+  void set_cts_pin(GPIOPin *pin) { this->cts_pin_ = pin; }
+
+  void set_cts_timeout(uint32_t timeout_ms) { this->cts_timeout_us_ = timeout_ms * 1000; }
+
+  void set_merge_config_properties(bool merge) { this->merge_config_properties_ = merge; }
 
-  void start_positioning(PositionCommand cmd);
+  void set_ez_frequency_programming(bool enable) { this->ez_frequency_programming_ = enable; }
+
+  void set_massage_coalesce_window(uint32_t window_ms) { this->massage_coalesce_window_ = window_ms; }
+
+  void set_receive(bool receive) { this->receive_ = receive; }
+
+  // Reads written properties back from the chip and checks them against the shadow
+  void set_verify_properties(bool verify_properties) { this->verify_properties_ = verify_properties; }
+
+  void set_lbt_threshold(int8_t threshold_dbm) {
+    this->lbt_ = true;
+    this->lbt_threshold_ = si446x_dbm_to_rssi(threshold_dbm);
+  }
+
+#ifdef USE_SENSOR
+  void set_lbt_deferrals_sensor(sensor::Sensor *sensor) { this->lbt_deferrals_sensor_ = sensor; }
+#endif
+
+  void set_learn_dwell_time(uint32_t dwell_time_ms) { this->learn_dwell_time_ = dwell_time_ms; }
+
+  void set_learn_timeout(uint32_t timeout_ms) { this->learn_timeout_ = timeout_ms; }
+
+  // Puts the radio to sleep once it has had nothing to do for this long, 0 keeps it awake
+  void set_idle_sleep_time(uint32_t idle_sleep_time_ms) { this->idle_sleep_time_ = idle_sleep_time_ms; }
+
+  // While asleep with receive on, the wake-up timer opens an RX window this often
+  void set_rx_sniff_interval(uint32_t interval_ms) { this->rx_sniff_interval_ = interval_ms; }
+  void set_rx_sniff_window(uint32_t window_ms) { this->rx_sniff_window_ = window_ms; }
+
+  // The command methods return the id of the queued request, or 0 when there was nothing to send
+  uint32_t execute_simple_command(SimpleCommand cmd);
+
+  uint32_t start_positioning(PositionCommand cmd);
+
+  uint32_t move_for(PositionCommand cmd, uint32_t duration_ms);
+
+  uint32_t move_to_position(PositionAxis axis, float position);
+
+  float get_position(PositionAxis axis) const;
+
+  // Time the axis takes to go from flat to fully raised
+  void set_travel_time(PositionAxis axis, uint32_t travel_time_ms) {
+    this->axes_[static_cast<uint8_t>(axis)].travel_time = travel_time_ms;
+  }
+
+#ifdef USE_SENSOR
+  void set_position_sensor(PositionAxis axis, sensor::Sensor *sensor) {
+    this->axes_[static_cast<uint8_t>(axis)].sensor = sensor;
+  }
+#endif
 
   void set_channel(uint16_t channel);
 
-  void set_massage_level(MassageTarget target, uint8_t level);
+  uint32_t set_massage_level(MassageTarget target, uint8_t level);
+
+  // Last known massage level, including changes made with a physical remote when receive is enabled
+  uint8_t get_massage_level(MassageTarget target) const;
+
+  void add_on_state_callback(std::function<void()> &&callback) { this->state_callback_.add(std::move(callback)); }
+
+  // Sweeps the channel space in RX until a remote is heard, then adopts the channel from its packet
+  void start_channel_learning();
+
+  void add_on_channel_learned_callback(std::function<void(uint16_t)> &&callback) {
+    this->channel_learned_callback_.add(std::move(callback));
+  }
+
+  // Called on the main loop with a request id once its last repeat has left the radio (sent) or it was dropped
+  void add_on_tx_complete_callback(std::function<void(uint32_t, bool)> &&callback) {
+    this->tx_complete_callback_.add(std::move(callback));
+  }
+
+  // Logs the radio metrics, and starts them over with reset
+  void dump_metrics(bool reset);
+
+  // Logs the SPI trace ring for scripts/decode_trace.py, oldest entry first
+  void dump_trace();
+
+#ifdef USE_SENSOR
+  void set_action_latency_sensor(sensor::Sensor *sensor) { this->action_latency_sensor_ = sensor; }
+  void set_packet_spi_time_sensor(sensor::Sensor *sensor) { this->packet_spi_time_sensor_ = sensor; }
+  void set_cts_wait_sensor(sensor::Sensor *sensor) { this->cts_wait_sensor_ = sensor; }
+  void set_packet_sent_timeouts_sensor(sensor::Sensor *sensor) { this->packet_sent_timeouts_sensor_ = sensor; }
+  void set_queue_depth_sensor(sensor::Sensor *sensor) { this->queue_depth_sensor_ = sensor; }
+  void set_wake_latency_sensor(sensor::Sensor *sensor) { this->wake_latency_sensor_ = sensor; }
+#endif
+  void set_metrics_update_interval(uint32_t interval_ms) { this->metrics_update_interval_ = interval_ms; }
 
   void si446x_get_int_status(Si446xGetIntStatusResp *ret, bool clear_pending);
 
  protected:
-  void si446x_raw_command_(const uint8_t *tx_data, size_t tx_data_bytes, uint8_t *resp, size_t resp_bytes);
+  bool radio_init_();
+  void recover_radio_();
+
+  void trace_(uint32_t timestamp_us, uint8_t opcode, size_t length, uint32_t cts_polls, uint8_t flags) {
+#ifdef USE_TEMPERBRIDGE_TRACE
+    SpiTraceEntry &entry = this->trace_entries_[this->trace_next_++ % SPI_TRACE_ENTRIES];
+    entry.timestamp_us = timestamp_us;
+    entry.opcode = opcode;
+    entry.length = length;
+    entry.cts_polls = cts_polls > 0xFF ? 0xFF : cts_polls;
+    entry.flags = flags;
+#endif
+  }
+#ifdef USE_TEMPERBRIDGE_TRACE
+  // Like metrics_, written where the radio is serviced and only copied under radio_lock_ by dump_trace()
+  std::array<SpiTraceEntry, SPI_TRACE_ENTRIES> trace_entries_{};
+  uint32_t trace_next_ = 0;
+#endif
+
+  bool si446x_wait_cts_(bool keep_selected);
+  void si446x_cts_timeout_(uint8_t command);
+  bool si446x_raw_command_(uint8_t command, const uint8_t *args, size_t arg_bytes, const uint8_t *data,
+                           size_t data_bytes, uint8_t *resp, size_t resp_bytes);
   void si446x_execute_command_(uint8_t command, const uint8_t *args, size_t arg_bytes, uint8_t *data, size_t data_bytes);
   Si446xChipInfoResp si446x_part_info_();
   void si446x_configuration_init_(const uint8_t *data);
   void si446x_fifo_info_(Si446xFifoInfoResp *ret, bool clear_rx, bool clear_tx);
-  void si446x_start_tx_();
-  void si446x_set_freq_control_properties_(uint8_t freq_control_inte, uint32_t freq_control_frac);
+  void si446x_start_tx_(uint8_t channel, bool retransmit);
+  void si446x_set_freq_control_properties_(uint8_t freq_control_inte, uint32_t freq_control_frac,
+                                           uint16_t channel_step_size);
   void si446x_set_property_(Si446xSetPropertyArgs *args, uint8_t *data);
-  void si446x_get_freq_control_properties_(uint8_t *freq_control_inte, uint32_t *freq_control_frac);
+  void si446x_verify_properties_(uint8_t group, uint8_t start_prop, uint8_t num_props);
   void si446x_get_property_(Si446xGetPropertyArgs *args, uint8_t *props);
 
-  void transmit_command_(uint32_t command);
-
-  void read_irq_pend_frr();
+  void transmit_command_(uint32_t command, uint16_t channel);
+  void retransmit_command_(uint16_t channel);
+  uint32_t queue_command_(uint32_t command, uint8_t repeats, TxPriority priority = TxPriority::NORMAL,
+                          uint8_t coalesce_key = 0, uint32_t id = 0, uint32_t hold_ms = 0);
+  uint32_t allocate_tx_id_();
+  void complete_tx_(uint32_t id, bool sent);
+  void service_tx_();
+  void enqueue_tx_(const RadioMessage &message);
+  void begin_packet_(bool retransmit);
+  void send_packet_();
+
+  Si446xIntPend read_irq_pend_frr();
+  void si446x_clear_int_pend_(uint8_t ph_pend, uint8_t modem_pend, uint8_t chip_pend);
+
+  void service_irq_();
+  void handle_int_pend_(Si446xIntPend pend);
+
+  // Sleeps the radio after idle_sleep_time_, wake_radio_() brings it back for anything that needs it
+  void service_power_();
+  void enter_sleep_();
+  bool wake_radio_();
+  bool radio_idle_() const;
+
+  // Everything that touches the radio goes through here so it can run on the radio task
+  void dispatch_(const RadioMessage &message);
+  void handle_radio_message_(const RadioMessage &message);
+  void service_radio_();
+  // Whether the radio task owns the radio. When it couldn't be started the main loop runs the radio instead.
+  bool radio_on_task_() const {
+#ifdef USE_TEMPERBRIDGE_RADIO_TASK
+    return this->store_.task != nullptr;
+#else
+    return false;
+#endif
+  }
+#ifdef USE_TEMPERBRIDGE_RADIO_TASK
+  static void radio_task_(void *arg);
+  SpscRingBuffer<RadioMessage, 16> radio_inbox_;
+  uint32_t radio_inbox_dropped_ = 0;
+#endif
+
+  uint16_t listen_channel_() const;
+  void start_rx_(uint16_t channel, uint8_t valid_state = SI446X_STATE_RX, uint8_t invalid_state = SI446X_STATE_RX);
+  void read_rx_packet_();
+  void process_rx_packets_();
+
+  void apply_channel_(uint16_t channel);
+  void begin_learning_();
+  void service_learning_();
+  void finish_learning_(uint16_t channel);
+  void complete_learning_(uint16_t channel);
+  void stop_learning_();
+  void si446x_change_state_(uint8_t state);
+  void si446x_get_modem_status_(Si446xModemStatusResp *ret);
 
   void tune_channel_(uint16_t channel);
 
+  uint32_t drive_(PositionCommand cmd, uint32_t duration_ms, float end_stop, uint32_t stop_id);
+  void track_motion_(PositionCommand cmd, uint32_t motion_id, uint32_t end_id, uint32_t duration_ms, float end_stop);
+  void position_tx_event_(const TxEvent &event);
+  void handle_tx_event_(const TxEvent &event);
+  void reset_positions_(float position);
+
+  uint32_t send_massage_level_(MassageTarget target, uint32_t id);
+  void supersede_massage_level_(MassageTarget target);
+  void set_massage_state_(uint8_t level, MassageCommandMode mode);
+  void stop_massage_();
+  void mirror_remote_command_(uint32_t command);
+
+#ifdef USE_TEMPERBRIDGE_BENCHMARK
+  void run_benchmark_();
+  TemperBridgeBenchmark benchmark_{};
+#endif
+  uint8_t select_channel_(uint16_t channel);
+
   bool initialized_ = false;
 
-  uint16_t channel_;
+  // Written where the radio is serviced, also read on the main loop
+  std::atomic<uint16_t> channel_{0};
+  bool ez_frequency_programming_ = false;
+  // Channel the synthesizer is currently programmed for, the EZ base channel when EZ frequency programming is on
+  uint16_t tuned_channel_ = 0;
+  bool tuned_channel_valid_ = false;
   InternalGPIOPin *interrupt_pin_;
   GPIOPin *sdn_pin_;
+  GPIOPin *cts_pin_{nullptr};
+  TemperBridgeStore store_;
+
+  uint32_t cts_timeout_us_ = 50000;
+  std::atomic<bool> radio_fault_{false};
+  uint32_t last_recovery_attempt_ = 0;
+
+  bool merge_config_properties_ = true;
+  Si446xChipInfoResp chip_info_{};
+  RadioBootTiming boot_timing_{};
+
+  RadioMetrics metrics_{};
+  // Held by the radio task for each service pass. The main loop takes it to copy or reset metrics_.
+  Mutex radio_lock_;
+  uint32_t metrics_update_interval_ = 60000;
+#ifdef USE_SENSOR
+  void publish_metrics_();
+  // Histograms as of the previous publish, the sensors report on what happened since
+  LatencyHistogram published_action_latency_;
+  LatencyHistogram published_packet_spi_;
+  LatencyHistogram published_cts_wait_;
+  LatencyHistogram published_wake_latency_;
+  sensor::Sensor *action_latency_sensor_{nullptr};
+  sensor::Sensor *packet_spi_time_sensor_{nullptr};
+  sensor::Sensor *cts_wait_sensor_{nullptr};
+  sensor::Sensor *packet_sent_timeouts_sensor_{nullptr};
+  sensor::Sensor *queue_depth_sensor_{nullptr};
+  sensor::Sensor *wake_latency_sensor_{nullptr};
+#endif
+
+  Si446xPropertyShadow property_shadow_;
+  std::atomic<uint32_t> property_writes_skipped_{0};
+  bool verify_properties_ = false;
+
+  BoundedQueue<TxRequest, 4> tx_queue_high_;
+  BoundedQueue<TxRequest, 16> tx_queue_normal_;
+  TxRequest tx_current_;
+  TxState tx_state_ = TxState::IDLE;
+  uint32_t tx_start_ = 0;
+  bool packet_sent_ = false;
+  bool tx_retransmit_ = false;
+  bool tx_last_packet_ = false;
+  uint32_t tx_hold_start_ = 0;
+  uint32_t next_tx_id_ = 0;
+  SpscRingBuffer<TxEvent, 32> tx_events_;
+  CallbackManager<void(uint32_t, bool)> tx_complete_callback_;
+
+  bool lbt_ = false;
+  uint8_t lbt_threshold_ = 0;
+  uint8_t tx_deferrals_ = 0;
+  std::atomic<uint32_t> lbt_deferrals_{0};
+  uint32_t lbt_deferrals_published_ = 0;
+  uint32_t cca_start_ = 0;
+  uint32_t cca_wait_us_ = 0;
+#ifdef USE_SENSOR
+  sensor::Sensor *lbt_deferrals_sensor_{nullptr};
+#endif
+
+  bool receive_ = false;
+  bool rx_active_ = false;
+  SpscRingBuffer<TemperPacket, 8> rx_packets_;
+  uint32_t rx_received_ = 0;
+  std::atomic<uint32_t> rx_invalid_{0};
+  std::atomic<uint32_t> rx_dropped_{0};
+
+  std::atomic<bool> learning_{false};
+  uint16_t learn_channel_ = 0;
+  uint32_t learn_start_ = 0;
+  uint32_t learn_hop_start_ = 0;
+  uint32_t learn_dwell_time_ = 100;
+  uint32_t learn_timeout_ = 60000;
+  CallbackManager<void(uint16_t)> channel_learned_callback_;
+  // Learned channels on their way from the radio owner to the callbacks on the main loop
+  SpscRingBuffer<uint16_t, 4> channels_learned_;
+  HighFrequencyLoopRequester high_freq_;
+
+  uint32_t idle_sleep_time_ = 0;
+  uint32_t rx_sniff_interval_ = 40;
+  uint32_t rx_sniff_window_ = 4;
+  bool asleep_ = false;
+  uint32_t idle_start_ = 0;
+  // Set from waking up until the first packet's START_TX
+  bool wake_pending_tx_ = false;
+  uint32_t wake_start_ = 0;
 
   uint8_t massage_leg_intensity_ = 0;
   uint8_t massage_head_intensity_ = 0;
   uint8_t massage_lumbar_intensity_ = 0;
   MassageCommandMode massage_command_mode_ = MassageCommandMode::CUSTOM;
+  uint32_t massage_coalesce_window_ = 0;
+  // Request ids of levels waiting out the coalesce window, indexed by MassageTarget
+  std::array<uint32_t, 3> massage_pending_ids_{};
+
+  // Indexed by PositionAxis
+  std::array<AxisPosition, 2> axes_{};
+  CallbackManager<void()> state_callback_;
 };
 
-template<typename... Ts> class ExecuteSimpleCommandAction : public Action<Ts...>, public Parented<TemperBridgeComponent> {
+// Base for actions that queue a radio command. The action only finishes once the command's last repeat has left
+// the radio, so the next action in a sequence can follow it without a guessed delay.
+template<typename... Ts> class TxAction : public Action<Ts...>, public Parented<TemperBridgeComponent> {
+ public:
+  // Subscribes here, during setup, because play_complex() can run from inside the TX complete callbacks, where adding
+  // one isn't allowed
+  void set_parent(TemperBridgeComponent *parent) {
+    Parented<TemperBridgeComponent>::set_parent(parent);
+    parent->add_on_tx_complete_callback([this](uint32_t id, bool sent) { this->tx_complete_(id); });
+  }
+
+  void play_complex(Ts... x) override {
+    this->num_running_++;
+    const uint32_t id = this->queue_(x...);
+    if (id == 0) {
+      this->play_next_(x...);
+      return;
+    }
+    this->pending_.emplace_back(id, std::make_tuple(x...));
+  }
+
+  void play(Ts... x) override { /* ignore - see play_complex */
+  }
+
+  void stop() override { this->pending_.clear(); }
+
+ protected:
+  virtual uint32_t queue_(Ts... x) = 0;
+
+  void tx_complete_(uint32_t id) {
+    for (auto it = this->pending_.begin(); it != this->pending_.end(); ++it) {
+      if (it->first == id) {
+        const auto args = it->second;
+        this->pending_.erase(it);
+        this->play_next_tuple_(args);
+        return;
+      }
+    }
+  }
+
+  std::vector<std::pair<uint32_t, std::tuple<Ts...>>> pending_;
+};
+
+template<typename... Ts> class ExecuteSimpleCommandAction : public TxAction<Ts...> {
  public:
   TEMPLATABLE_VALUE(SimpleCommand, cmd);
 
-  void play(Ts... x) override { this->parent_->execute_simple_command(this->cmd_.value(x...)); }
+ protected:
+  uint32_t queue_(Ts... x) override { return this->parent_->execute_simple_command(this->cmd_.value(x...)); }
 };
 
-template<typename... Ts> class PositionCommandAction : public Action<Ts...>, public Parented<TemperBridgeComponent> {
+template<typename... Ts> class PositionCommandAction : public TxAction<Ts...> {
  public:
   TEMPLATABLE_VALUE(PositionCommand, cmd);
+  TEMPLATABLE_VALUE(uint32_t, duration);
+
+ protected:
+  uint32_t queue_(Ts... x) override {
+    auto cmd = this->cmd_.value(x...);
+    // Without a duration it's a short nudge
+    if (!this->duration_.has_value()) {
+      return this->parent_->start_positioning(cmd);
+    }
+    return this->parent_->move_for(cmd, this->duration_.value(x...));
+  }
+};
 
-  void play(Ts... x) override { this->parent_->start_positioning(this->cmd_.value(x...)); }
+template<typename... Ts> class MoveToPositionAction : public TxAction<Ts...> {
+ public:
+  TEMPLATABLE_VALUE(PositionAxis, axis);
+  TEMPLATABLE_VALUE(float, position);
+
+ protected:
+  uint32_t queue_(Ts... x) override {
+    return this->parent_->move_to_position(this->axis_.value(x...), this->position_.value(x...));
+  }
 };
 
 template<typename... Ts> class SetChannelAction : public Action<Ts...>, public Parented<TemperBridgeComponent> {
  public:
   TEMPLATABLE_VALUE(uint16_t, channel)
 
-  void play(Ts... x) override {
-    auto channel = this->channel_.value(x...);
-    ESP_LOGI("temperbridge", "channel: %d", channel);
-    this->parent_->set_channel(channel);
+  void play(Ts... x) override { this->parent_->set_channel(this->channel_.value(x...)); }
+};
+
+template<typename... Ts> class DumpMetricsAction : public Action<Ts...>, public Parented<TemperBridgeComponent> {
+ public:
+  TEMPLATABLE_VALUE(bool, reset)
+
+  void play(Ts... x) override { this->parent_->dump_metrics(this->reset_.value(x...)); }
+};
+
+template<typename... Ts> class DumpTraceAction : public Action<Ts...>, public Parented<TemperBridgeComponent> {
+ public:
+  void play(Ts... x) override { this->parent_->dump_trace(); }
+};
+
+template<typename... Ts> class LearnChannelAction : public Action<Ts...>, public Parented<TemperBridgeComponent> {
+ public:
+  void play(Ts... x) override { this->parent_->start_channel_learning(); }
+};
+
+class ChannelLearnedTrigger : public Trigger<uint16_t> {
+ public:
+  explicit ChannelLearnedTrigger(TemperBridgeComponent *parent) {
+    parent->add_on_channel_learned_callback([this](uint16_t channel) { this->trigger(channel); });
   }
 };
 
-template<typename... Ts> class SetMassageIntensityAction : public Action<Ts...>, public Parented<TemperBridgeComponent> {
+template<typename... Ts> class SetMassageIntensityAction : public TxAction<Ts...> {
  public:
   TEMPLATABLE_VALUE(MassageTarget, target)
   TEMPLATABLE_VALUE(uint8_t, level)
 
-  void play(Ts... x) override {
+ protected:
+  uint32_t queue_(Ts... x) override {
     auto target = this->target_.value(x...);
     auto level = this->level_.value(x...);
-    this->parent_->set_massage_level(target, level);
+    return this->parent_->set_massage_level(target, level);
   }
 };
 